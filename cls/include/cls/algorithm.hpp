@@ -28,6 +28,7 @@
 #include <algorithm>
 #include <numeric>
 #include <functional>
+#include <ostream>
 #include "traits.hpp"
 
 CLS_BEGIN
@@ -115,6 +116,136 @@ inline std::ostream& operator<<(std::ostream& os, const Container<T>& c)
     return os;
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////
+// Segmented containers
+// A container with segments(), like cls::Deque, is processed one contiguous block at a
+// time, the inner loops then run on plain pointers and can be vectorized
+namespace detail {
+template<typename Container, typename Func>
+inline void for_each_impl(Container&& container, Func func, std::false_type)
+{
+    std::for_each(std::begin(container), std::end(container), func);
+}
+
+template<typename Container, typename Func>
+inline void for_each_impl(Container&& container, Func func, std::true_type)
+{
+    for (auto segment : container.segments()) {
+        for (auto& element : segment) {
+            func(element);
+        }
+    }
+}
+
+template<typename Container, typename T,
+         typename Difference = iterator_difference_t<
+             decltype(std::begin(std::declval<Container&>()))>>
+inline Difference count_impl(Container&& container, const T& value, std::false_type)
+{
+    return std::count(std::begin(container), std::end(container), value);
+}
+
+template<typename Container, typename T,
+         typename Difference = iterator_difference_t<
+             decltype(std::begin(std::declval<Container&>()))>>
+inline Difference count_impl(Container&& container, const T& value, std::true_type)
+{
+    Difference n = 0;
+    for (auto segment : container.segments()) {
+        n += std::count(segment.begin(), segment.end(), value);
+    }
+
+    return n;
+}
+
+template<typename Container, typename T>
+inline auto find_impl(Container& container, const T& value, std::false_type) ->
+decltype(std::begin(container))
+{
+    return std::find(std::begin(container), std::end(container), value);
+}
+
+template<typename Container, typename T>
+inline auto find_impl(Container& container, const T& value, std::true_type) ->
+decltype(std::begin(container))
+{
+    iterator_difference_t<decltype(std::begin(container))> offset = 0;
+    for (auto segment : container.segments()) {
+        auto iter = std::find(segment.begin(), segment.end(), value);
+        if (iter != segment.end()) {
+            return std::next(std::begin(container), offset + (iter - segment.begin()));
+        }
+        offset += segment.size();
+    }
+
+    return std::end(container);
+}
+
+template<typename Container, typename OutputIt>
+inline auto copy_impl(Container&& container, OutputIt d_first, std::false_type) -> OutputIt
+{
+    return std::copy(std::begin(container), std::end(container), d_first);
+}
+
+template<typename Container, typename OutputIt>
+inline auto copy_impl(Container&& container, OutputIt d_first, std::true_type) -> OutputIt
+{
+    for (auto segment : container.segments()) {
+        d_first = std::copy(segment.begin(), segment.end(), d_first);
+    }
+
+    return d_first;
+}
+
+template<typename Container, typename T>
+inline void fill_impl(Container& container, const T& value, std::false_type)
+{
+    std::fill(std::begin(container), std::end(container), value);
+}
+
+template<typename Container, typename T>
+inline void fill_impl(Container& container, const T& value, std::true_type)
+{
+    for (auto segment : container.segments()) {
+        std::fill(segment.begin(), segment.end(), value);
+    }
+}
+
+template<typename Container, typename OutputIt, typename UPred>
+inline auto transform_impl(Container&& container, OutputIt d_first, UPred p, std::false_type) ->
+OutputIt
+{
+    return std::transform(std::begin(container), std::end(container), d_first, p);
+}
+
+template<typename Container, typename OutputIt, typename UPred>
+inline auto transform_impl(Container&& container, OutputIt d_first, UPred p, std::true_type) ->
+OutputIt
+{
+    for (auto segment : container.segments()) {
+        d_first = std::transform(segment.begin(), segment.end(), d_first, p);
+    }
+
+    return d_first;
+}
+
+template<typename Container, typename T, typename BOperator>
+inline T accumulate_impl(Container&& container, T init, BOperator op, std::false_type)
+{
+    return std::accumulate(std::begin(container), std::end(container), init, op);
+}
+
+template<typename Container, typename T, typename BOperator>
+inline T accumulate_impl(Container&& container, T init, BOperator op, std::true_type)
+{
+    for (auto segment : container.segments()) {
+        init = std::accumulate(segment.begin(), segment.end(), init, op);
+    }
+
+    return init;
+}
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////
 // Non-modifying sequence operations
 template<typename Container, typename Func,
@@ -142,7 +273,7 @@ template<typename Container, typename Func,
          typename U = enable_if_t<is_container<Container>::value>>
 inline void for_each(Container&& container, Func func)
 {
-    for_each(std::begin(container), std::end(container), func);
+    detail::for_each_impl(container, func, has_segments<Container>{});
 }
 
 // Initializer list overload
@@ -157,7 +288,7 @@ template<typename Container, typename T,
 inline auto count(Container&& container, const T& value) ->
 iterator_difference_t<decltype(std::begin(container))>
 {
-    return count(std::begin(container), std::end(container), value);
+    return detail::count_impl(container, value, has_segments<Container>{});
 }
 
 template<typename Container, typename UPred,
@@ -235,7 +366,7 @@ template<typename Container, typename T,
          typename U = enable_if_t<is_container<Container>::value>>
 inline auto find(Container& container, const T& value) -> decltype(std::begin(container))
 {
-    return find(std::begin(container), std::end(container), value);
+    return detail::find_impl(container, value, has_segments<Container>{});
 }
 
 template<typename Container, typename UPred,
@@ -408,7 +539,7 @@ template<typename Container1, typename Container2,
 inline void copy(Container1&& container1, Container2& container2)
 {
     container2.resize(container_size(container1));
-    copy(std::begin(container1), std::end(container1), std::begin(container2));
+    detail::copy_impl(container1, std::begin(container2), has_segments<Container1>{});
 }
 
 // Container to output iterator
@@ -417,7 +548,7 @@ template<typename Container, typename OutputIt,
                                   is_output_iterator<OutputIt>::value>>
 inline auto copy(Container&& container, OutputIt d_first) -> OutputIt
 {
-    return copy(std::begin(container), std::end(container), d_first);
+    return detail::copy_impl(container, d_first, has_segments<Container>{});
 }
 
 // Initializer list to output iterator
@@ -498,7 +629,7 @@ template<typename Container, typename T,
          typename U = enable_if_t<is_container<Container>::value>>
 inline void fill(Container& container, const T& value)
 {
-    fill(std::begin(container), std::end(container), value);
+    detail::fill_impl(container, value, has_segments<Container>{});
 }
 
 // Container to container, automatically resize
@@ -508,7 +639,7 @@ template<typename Container1, typename Container2, typename UPred,
 inline void transform(Container1&& container1, Container2& container2, UPred p)
 {
     container2.resize(container_size(container1));
-    transform(std::begin(container1), std::end(container1), std::begin(container2), p);
+    detail::transform_impl(container1, std::begin(container2), p, has_segments<Container1>{});
 }
 
 // Container to output iterator
@@ -517,7 +648,7 @@ template<typename Container, typename OutputIt, typename UPred,
                                   is_output_iterator<OutputIt>::value>>
 inline auto transform(Container&& container, OutputIt d_first, UPred p) -> OutputIt
 {
-    return transform(std::begin(container), std::end(container), d_first, p);
+    return detail::transform_impl(container, d_first, p, has_segments<Container>{});
 }
 
 // Two containers to output iterator
@@ -901,7 +1032,7 @@ template<typename Container,
 inline T accumulate(Container&& container)
 {
     T init = T();
-    return accumulate(std::begin(container), std::end(container), init);
+    return detail::accumulate_impl(container, init, std::plus<>{}, has_segments<Container>{});
 }
 
 template<typename Container, typename BOperator,
@@ -910,14 +1041,14 @@ template<typename Container, typename BOperator,
 inline T accumulate(Container&& container, BOperator op)
 {
     T init = T();
-    return accumulate(std::begin(container), std::end(container), init, op);
+    return detail::accumulate_impl(container, init, op, has_segments<Container>{});
 }
 
 template<typename Container, typename T, typename BOperator,
          typename U = enable_if_t<is_container<Container>::value>>
 inline T accumulate(Container&& container, T init, BOperator op)
 {
-    return accumulate(std::begin(container), std::end(container), init, op);
+    return detail::accumulate_impl(container, init, op, has_segments<Container>{});
 }
 
 template<typename Container1, typename Container2,
@@ -27,6 +27,7 @@
 
 #include <iterator>
 #include <type_traits>
+#include <utility>
 #include "cls_defs.h"
 
 CLS_BEGIN
@@ -75,6 +76,17 @@ template<typename T, size_t N>
 struct is_container<T[N], void> : std::true_type
 {};
 
+// Container made of contiguous blocks, segments() returns a range of spans over the blocks
+template<typename T, typename = void>
+struct has_segments : std::false_type
+{};
+
+template<typename T>
+struct has_segments<T, std::enable_if_t<!std::is_same<
+    decltype(std::declval<T&>().segments()),
+    void>::value>> : std::true_type
+{};
+
 template <typename Container, bool = is_container<Container>::value>
 struct ContainerTraits
 {};
@@ -22,6 +22,7 @@
 // SOFTWARE.
 /////////////////////////////////////////////////////////////////////////////////
 
+#include <array>
 #include <random>
 
 #include <catch.hpp>
@@ -34,6 +35,33 @@ using namespace cls;
 namespace {
 vector<int> vec1 {9, 3, 5, 7, 9, 13, 9, 17, 17, 9};
 int arr1[] = {9, 3, 5, 7, 3, 11, 9, 1, 13, 9};
+
+// Contiguous storage split into segments [0, 3), [3, 3) and [3, size), so the segmented
+// algorithms can be checked against the plain ones on the same elements
+struct Segmented {
+    using iterator = vector<int>::iterator;
+
+    struct Segment {
+        int* first;
+        int* last;
+
+        int* begin() const { return first; }
+        int* end() const { return last; }
+        ptrdiff_t size() const { return last - first; }
+    };
+
+    iterator begin() { return data.begin(); }
+    iterator end() { return data.end(); }
+    size_t size() const { return data.size(); }
+
+    array<Segment, 3> segments()
+    {
+        auto p = data.data();
+        return {{{p, p + 3}, {p + 3, p + 3}, {p + 3, p + data.size()}}};
+    }
+
+    vector<int> data;
+};
 }
 
 TEST_CASE("Algorithm tests", "[algorithm]") {
@@ -117,6 +145,58 @@ TEST_CASE("Algorithm tests", "[algorithm]") {
     DBGVAR(cout, *minmax_val.second);
 }
 
+TEST_CASE("Segmented algorithm tests", "[algorithm]") {
+    static_assert(has_segments<Segmented&>::value, "Segmented is not segmented");
+
+    Segmented seg {{9, 3, 5, 7, 3, 11, 9, 1, 13, 9}};
+    auto plain = seg.data;
+
+    SECTION("for_each") {
+        vector<int> visited;
+        for_each(seg, [&visited](int ele) { visited.push_back(ele); });
+        CHECK(visited == plain);
+    }
+
+    SECTION("count") {
+        CHECK(count(seg, 9) == count(plain, 9));
+        CHECK(count(seg, 3) == 2);
+        CHECK(count(seg, 4) == 0);
+    }
+
+    SECTION("find") {
+        // Last element of the first segment, first of the last one, past the empty one
+        CHECK(find(seg, 5) == seg.begin() + 2);
+        CHECK(find(seg, 7) == seg.begin() + 3);
+        CHECK(find(seg, 11) == seg.begin() + 5);
+        CHECK(find(seg, 13) - seg.begin() == find(plain, 13) - plain.begin());
+        CHECK(find(seg, 4) == seg.end());
+    }
+
+    SECTION("copy") {
+        vector<int> out(seg.size());
+        CHECK(copy(seg, out.begin()) == out.end());
+        CHECK(out == plain);
+    }
+
+    SECTION("fill") {
+        fill(seg, -1);
+        CHECK(all_of(seg.data, [](int ele) { return ele == -1; }));
+    }
+
+    SECTION("transform") {
+        vector<int> out(seg.size());
+        vector<int> expected(plain.size());
+        CHECK(transform(seg, out.begin(), negate<int>()) == out.end());
+        transform(plain, expected.begin(), negate<int>());
+        CHECK(out == expected);
+    }
+
+    SECTION("accumulate") {
+        CHECK(accumulate(seg) == accumulate(plain));
+        CHECK(accumulate(seg, 1, multiplies<int>()) == accumulate(plain, 1, multiplies<int>()));
+    }
+}
+
 TEST_CASE("Print tests", "[print]") {
     CHECK(L"hello" == stows(string("hello")));
     CHECK("hello" == wstos(wstring(L"hello")));
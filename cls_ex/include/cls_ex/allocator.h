@@ -24,22 +24,120 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <fstream>
+#include <string>
 #include <thread>
 #include <mutex>
+#include <vector>
 #include <iostream>
 #include <boost/align/aligned_alloc.hpp>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#  if __has_include(<memory_resource>)
+#    define CLS_HAS_STD_PMR 1
+#  endif
+#endif
+
+#if CLS_HAS_STD_PMR
+#  include <memory_resource>
+#else
+#  include <boost/container/pmr/memory_resource.hpp>
+#endif
+
 #include <cls/cls_defs.h>
 
 CLS_BEGIN
 constexpr size_type MIN_ALIGNMENT = 16;
 constexpr size_type PLAT_PTR_SIZE = sizeof(void*);
 
+// Data written by different threads is kept this far apart to avoid false sharing
+constexpr size_type CACHE_LINE_SIZE = 64;
+
 #ifndef NDEBUG
 // Track memory allocation, detecting leak
 static thread_local size_type g_allocate_size = 0;
 #endif
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// HeapProfiler
+// Sampling heap profiler hooked into the allocation helpers below. While started, each thread picks about one
+// allocation per sample_interval bytes, at exponentially distributed distances, and records its stack trace. Live
+// samples are aggregated per call site and dumped as plain text or as a legacy pprof heap profile.
+// While stopped the hooks cost one relaxed load, define CLS_HEAP_PROFILER to 0 to compile them out.
+#ifndef CLS_HEAP_PROFILER
+#  define CLS_HEAP_PROFILER 1
+#endif
+
+class HeapProfiler {
+public:
+    static constexpr size_type DEFAULT_SAMPLE_INTERVAL = 512 * 1024;
+    static constexpr int MAX_FRAMES = 32;
+
+    static void start(size_type sample_interval = DEFAULT_SAMPLE_INTERVAL);
+
+    // Stop sampling, frees of sampled blocks are still tracked until reset()
+    static void stop();
+
+    // Stop and drop all samples
+    static void reset();
+
+    // Call sites with the most estimated live bytes, symbolized with backtrace_symbols
+    static void report(std::ostream& os, size_type max_sites = 20);
+
+    // Legacy pprof heap profile, e.g. pprof --text ./app heap.prof
+    static void write_pprof(std::ostream& os);
+
+    static void on_allocate(void* p, size_type n)
+    {
+#if CLS_HEAP_PROFILER
+        if (m_sampling.load(std::memory_order_relaxed) && p != nullptr && (m_bytes_until_sample -= n) < 0) {
+            sample(p, n);
+        }
+#else
+        (void)p;
+        (void)n;
+#endif
+    }
+
+    static void on_deallocate(void* p)
+    {
+#if CLS_HEAP_PROFILER
+        if (m_tracking.load(std::memory_order_relaxed) && p != nullptr &&
+            m_filter[filter_index(p)].load(std::memory_order_relaxed) != 0) {
+            forget(p);
+        }
+#else
+        (void)p;
+#endif
+    }
+
+private:
+    static constexpr size_type FILTER_SIZE = 1 << 16;
+
+    static size_type filter_index(const void* p)
+    {
+        const auto hash = (static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(p)) >> 4) * 0x9e3779b97f4a7c15;
+        return static_cast<size_type>(hash >> 48);
+    }
+
+    static void sample(void* p, size_type n);
+    static void forget(void* p);
+
+    static std::atomic<bool> m_sampling;
+    static std::atomic<bool> m_tracking;
+
+    // Number of live samples hashed to each slot, a free only looks for its sample if the slot is not empty
+    static std::array<std::atomic<std::uint16_t>, FILTER_SIZE> m_filter;
+
+    static thread_local size_type m_bytes_until_sample;
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Allocation helpers
 template <typename Alloc>
@@ -50,11 +148,10 @@ void* alloc_memory(Alloc* alloc, size_type n, size_type alignment)
     // printf("Allocate %d bytes\n", n);
 #endif
 
-    if (alignment <= MIN_ALIGNMENT) {
-        return alloc->allocate(n);
-    }
+    auto p = alignment <= MIN_ALIGNMENT ? alloc->allocate(n) : alloc->allocate(n, alignment);
+    HeapProfiler::on_allocate(p, n);
 
-    return alloc->allocate(n, alignment);
+    return p;
 }
 
 template <typename Alloc>
@@ -87,6 +184,7 @@ void dealloc_memory(Alloc* alloc, void* p, size_type n)
     }
 #endif
 
+    HeapProfiler::on_deallocate(p);
     alloc->deallocate(p, n);
 }
 
@@ -96,6 +194,68 @@ void dealloc_memory(Alloc& alloc, void* p, size_type n)
     dealloc_memory(&alloc, p, n);
 }
 
+// Resize the block at p in place, return false if the allocator can't do that
+template <typename Alloc>
+bool expand_memory(Alloc* alloc, void* p, size_type old_n, size_type new_n)
+{
+    if (!alloc->try_expand(p, old_n, new_n)) {
+        return false;
+    }
+
+#ifndef NDEBUG
+    g_allocate_size += new_n - old_n;
+#endif
+
+    return true;
+}
+
+template <typename Alloc>
+bool expand_memory(Alloc& alloc, void* p, size_type old_n, size_type new_n)
+{
+    return expand_memory(&alloc, p, old_n, new_n);
+}
+
+// Allocate count blocks of n bytes each into out, return the number of blocks allocated
+template <typename Alloc>
+size_type alloc_memory_bulk(Alloc* alloc, size_type count, size_type n, size_type alignment, void** out)
+{
+    const auto num_allocated = alloc->allocate_bulk(count, n, alignment, out);
+    for (size_type i = 0; i < num_allocated; ++i) {
+        HeapProfiler::on_allocate(out[i], n);
+    }
+
+#ifndef NDEBUG
+    g_allocate_size += num_allocated * n;
+#endif
+
+    return num_allocated;
+}
+
+template <typename Alloc>
+size_type alloc_memory_bulk(Alloc& alloc, size_type count, size_type n, size_type alignment, void** out)
+{
+    return alloc_memory_bulk(&alloc, count, n, alignment, out);
+}
+
+template <typename Alloc>
+void dealloc_memory_bulk(Alloc* alloc, size_type count, size_type n, void* const* ptrs)
+{
+#ifndef NDEBUG
+    g_allocate_size -= count * n;
+#endif
+
+    for (size_type i = 0; i < count; ++i) {
+        HeapProfiler::on_deallocate(ptrs[i]);
+    }
+    alloc->deallocate_bulk(count, n, ptrs);
+}
+
+template <typename Alloc>
+void dealloc_memory_bulk(Alloc& alloc, size_type count, size_type n, void* const* ptrs)
+{
+    dealloc_memory_bulk(&alloc, count, n, ptrs);
+}
+
 template <typename T, typename Alloc>
 void dealloc_array(Alloc* alloc, gsl::span<T> array)
 {
@@ -139,43 +299,279 @@ public:
     virtual void* allocate(size_type n) = 0;
     virtual void* allocate(size_type n, size_type alignment) = 0;
     virtual void  deallocate(void* p, size_type n) = 0;
+
+    // Resize the block at p from old_n to new_n bytes without moving it. Return false if that's not possible, the
+    // block is left untouched then. Afterwards the block must be deallocated with new_n.
+    // The default implementation can't resize anything.
+    virtual bool try_expand(void* p, size_type old_n, size_type new_n);
+
+    // Allocate count blocks of n bytes into out, return how many were allocated, which is less than count only if
+    // we ran out of memory. Each block may be deallocated on its own.
+    // The default implementations loop over allocate/deallocate.
+    virtual size_type allocate_bulk(size_type count, size_type n, size_type alignment, void** out);
+    virtual void deallocate_bulk(size_type count, size_type n, void* const* ptrs);
 };
 
-// The global allocator used in system
+// The allocator used in system. Each thread has its own stack of active allocators, maintained by
+// ScopedActiveAllocator, and falls back to the process-wide allocator when its stack is empty.
 class ActiveAllocator {
     static std::unique_ptr<Allocator> m_allocator;
+    static std::atomic<Allocator*> m_global;
+    static thread_local Allocator* m_thread_active;
+
+    // Allocators replaced by reset(), kept until exit
+    static std::mutex m_reset_mtx;
+    static std::vector<std::unique_ptr<Allocator>> m_retired;
 
 public:
-    static Allocator* get() { return m_allocator.get(); }
-    static void reset(Allocator* alloc) { m_allocator.reset(alloc); }
-    static void reset(std::unique_ptr<Allocator>&& alloc) { m_allocator = std::move(alloc); }
+    static Allocator* get()
+    {
+        auto alloc = m_thread_active;
+        return alloc != nullptr ? alloc : m_global.load(std::memory_order_acquire);
+    }
+
+    // Replace the process-wide allocator, threads with their own active allocator are not affected. The replaced
+    // allocator is kept alive until exit, since other threads may still be using it or hold blocks allocated from it
+    static void reset(Allocator* alloc) { reset(std::unique_ptr<Allocator> {alloc}); }
+    static void reset(std::unique_ptr<Allocator>&& alloc);
+
+    // Make a non-owned allocator active in the calling thread, return the previous one of this thread or nullptr if
+    // it was using the process-wide allocator. Pass nullptr to fall back to the process-wide allocator.
+    static Allocator* exchange(Allocator* alloc)
+    {
+        auto prev = m_thread_active;
+        m_thread_active = alloc;
+        return prev;
+    }
+};
+
+// Push an allocator on the calling thread's active allocator stack for the lifetime of this object.
+// Containers must be destroyed under the same allocator they were created with.
+class ScopedActiveAllocator {
+public:
+    explicit ScopedActiveAllocator(Allocator& alloc) : m_prev {ActiveAllocator::exchange(&alloc)} {}
+    ~ScopedActiveAllocator() { ActiveAllocator::exchange(m_prev); }
+
+    ScopedActiveAllocator(const ScopedActiveAllocator&) = delete;
+    ScopedActiveAllocator& operator=(const ScopedActiveAllocator&) = delete;
+
+private:
+    Allocator* m_prev;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Allocation policies, for containers which take the allocator as a template parameter. A policy is an empty type
+// with static allocate/deallocate, so it can be passed to alloc_memory/dealloc_memory like an allocator.
+
+// Resolve the active allocator at run time on each call
+struct ActiveAllocatorPolicy {
+    static void* allocate(size_type n) { return ActiveAllocator::get()->allocate(n); }
+    static void* allocate(size_type n, size_type alignment) { return ActiveAllocator::get()->allocate(n, alignment); }
+    static void  deallocate(void* p, size_type n) { ActiveAllocator::get()->deallocate(p, n); }
+
+    static bool try_expand(void* p, size_type old_n, size_type new_n)
+    {
+        return ActiveAllocator::get()->try_expand(p, old_n, new_n);
+    }
+
+    static size_type allocate_bulk(size_type count, size_type n, size_type alignment, void** out)
+    {
+        return ActiveAllocator::get()->allocate_bulk(count, n, alignment, out);
+    }
+
+    static void deallocate_bulk(size_type count, size_type n, void* const* ptrs)
+    {
+        ActiveAllocator::get()->deallocate_bulk(count, n, ptrs);
+    }
 };
 
-// Used in STL types which require an allocator
+// Bind to one process-wide instance of a concrete allocator type. The calls are not virtual, and are inlined if
+// AllocT is defined in a header.
+template <typename AllocT>
+struct StaticAllocatorPolicy {
+    static AllocT& instance()
+    {
+        static AllocT alloc;
+        return alloc;
+    }
+
+    static void* allocate(size_type n) { return instance().AllocT::allocate(n); }
+    static void* allocate(size_type n, size_type alignment) { return instance().AllocT::allocate(n, alignment); }
+    static void  deallocate(void* p, size_type n) { instance().AllocT::deallocate(p, n); }
+
+    static bool try_expand(void* p, size_type old_n, size_type new_n)
+    {
+        return instance().AllocT::try_expand(p, old_n, new_n);
+    }
+
+    static size_type allocate_bulk(size_type count, size_type n, size_type alignment, void** out)
+    {
+        return instance().AllocT::allocate_bulk(count, n, alignment, out);
+    }
+
+    static void deallocate_bulk(size_type count, size_type n, void* const* ptrs)
+    {
+        instance().AllocT::deallocate_bulk(count, n, ptrs);
+    }
+};
+
+// Used in STL types which require an allocator. Bound to one Allocator, the active allocator at construction unless
+// given explicitly, which is shared by copies and rebinds. Copy assignment keeps the target's allocator, while move
+// assignment and swap carry the source's allocator along, so they never copy elements. That is unlike
+// std::pmr::polymorphic_allocator, which never propagates.
 template <typename T>
 class STLAllocator {
 public:
     using value_type = T;
     using size_type = cls::size_type;
 
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap            = std::true_type;
+    using is_always_equal                        = std::false_type;
+
+    template <typename U>
+    struct rebind {
+        using other = STLAllocator<U>;
+    };
+
+    STLAllocator() noexcept : m_alloc {ActiveAllocator::get()} {}
+
+    STLAllocator(Allocator& alloc) noexcept : m_alloc {&alloc} {}
+
+    template <typename U>
+    STLAllocator(const STLAllocator<U>& other) noexcept : m_alloc {other.allocator()} {}
+
+    Allocator* allocator() const noexcept { return m_alloc; }
+
     T* allocate(size_type n)
     {
-        return static_cast<T*>(alloc_memory(ActiveAllocator::get(), size_of<T> * n, align_of<T>));
+        auto p = alloc_memory(m_alloc, size_of<T> * n, align_of<T>);
+        if (p == nullptr) {
+            throw std::bad_alloc {};
+        }
+        return static_cast<T*>(p);
     }
 
     void deallocate(T* p, size_type n)
     {
-        dealloc_memory(ActiveAllocator::get(), p, size_of<T> * n);
+        dealloc_memory(m_alloc, p, size_of<T> * n);
     }
+
+private:
+    Allocator* m_alloc;
+};
+
+// STLAllocators are interchangeable if they are bound to the same Allocator
+template <typename T, typename U>
+inline bool operator==(const STLAllocator<T>& lhs, const STLAllocator<U>& rhs)
+{
+    return lhs.allocator() == rhs.allocator();
+}
+
+template <typename T, typename U>
+inline bool operator!=(const STLAllocator<T>& lhs, const STLAllocator<U>& rhs)
+{
+    return !(lhs == rhs);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// memory_resource adapters
+// std::pmr needs C++17, Boost.Container provides the same interface before that
+namespace pmr {
+#if CLS_HAS_STD_PMR
+using std::pmr::memory_resource;
+#else
+using boost::container::pmr::memory_resource;
+#endif
+}
+
+// Expose an Allocator as a memory_resource, e.g. for pmr containers
+class MemoryResourceAdapter : public pmr::memory_resource {
+public:
+    explicit MemoryResourceAdapter(Allocator& alloc) noexcept : m_alloc {&alloc} {}
+
+    Allocator* allocator() const noexcept { return m_alloc; }
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        auto p = alloc_memory(m_alloc, static_cast<size_type>(bytes), static_cast<size_type>(alignment));
+        if (p == nullptr) {
+            throw std::bad_alloc {};
+        }
+        return p;
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t) override
+    {
+        dealloc_memory(m_alloc, p, static_cast<size_type>(bytes));
+    }
+
+    bool do_is_equal(const pmr::memory_resource& other) const noexcept override
+    {
+        auto adapter = dynamic_cast<const MemoryResourceAdapter*>(&other);
+        return adapter != nullptr && adapter->m_alloc == m_alloc;
+    }
+
+private:
+    Allocator* m_alloc;
+};
+
+// Use a memory_resource as an Allocator. deallocate() doesn't know the alignment the block was allocated with, so
+// every block is requested with MIN_ALIGNMENT and larger alignments are not supported.
+class MemoryResourceAllocator : public Allocator {
+public:
+    explicit MemoryResourceAllocator(pmr::memory_resource& resource) noexcept : m_resource {&resource} {}
+
+    pmr::memory_resource* resource() const noexcept { return m_resource; }
+
+    void* allocate(size_type n) override
+    {
+        return allocate(n, MIN_ALIGNMENT);
+    }
+
+    void* allocate(size_type n, size_type alignment) override
+    {
+        if (alignment > MIN_ALIGNMENT) {
+            return nullptr;
+        }
+
+        try {
+            return m_resource->allocate(static_cast<std::size_t>(n), static_cast<std::size_t>(MIN_ALIGNMENT));
+        } catch (const std::bad_alloc&) {
+            return nullptr;
+        }
+    }
+
+    void deallocate(void* p, size_type n) override
+    {
+        m_resource->deallocate(p, static_cast<std::size_t>(n), static_cast<std::size_t>(MIN_ALIGNMENT));
+    }
+
+private:
+    pmr::memory_resource* m_resource;
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // DefaultAllocator
 class DefaultAllocator : public Allocator {
 public:
-    void* allocate(size_type n) override;
-    void* allocate(size_type n, size_type alignment) override;
-    void  deallocate(void* p, size_type) override;
+    void* allocate(size_type n) override
+    {
+        return boost::alignment::aligned_alloc(static_cast<size_t>(MIN_ALIGNMENT), static_cast<size_t>(n));
+    }
+
+    void* allocate(size_type n, size_type alignment) override
+    {
+        return boost::alignment::aligned_alloc(
+            static_cast<size_t>(std::max(MIN_ALIGNMENT, alignment)), static_cast<size_t>(n));
+    }
+
+    void deallocate(void* p, size_type) override
+    {
+        boost::alignment::aligned_free(p);
+    }
 };
 
 inline bool operator==(const DefaultAllocator&, const DefaultAllocator&)
@@ -188,4 +584,707 @@ inline bool operator!=(const DefaultAllocator&, const DefaultAllocator&)
     return false;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// PoolAllocator
+// Power-of-two size classes from MIN_CLASS_SIZE to MAX_CLASS_SIZE. Each thread keeps a small cache of free blocks
+// per class and exchanges them in batches with a central free list, so most allocate/deallocate calls never take a
+// lock. Blocks are aligned to their class size. Larger requests are passed on to the system allocator.
+// All memory is returned when the pool is destroyed, so it must outlive every container allocated from it.
+//
+// In REMOTE mode every chunk belongs to the thread which carved it and there is no central list. A block freed by
+// another thread is pushed onto a lock-free remote list of its owner, which takes the whole list back on its next
+// allocation that misses the cache. This suits pipelines where blocks are mostly freed by a different thread.
+//
+// When a thread exits, its caches are flushed to the central lists and handed to the next thread which starts using
+// the pool, in REMOTE mode together with the chunks they own. Each thread remembers the caches of the last
+// MAX_THREAD_POOLS pools it used, switching between more pools than that goes through a lock. Threads which allocate
+// or free after their caches have been released at exit share one cache under a lock.
+class PoolAllocator : public Allocator {
+public:
+    enum class FreeMode {CENTRAL, REMOTE};
+
+    static constexpr size_type MIN_CLASS_SIZE = MIN_ALIGNMENT;
+    static constexpr size_type MAX_CLASS_SIZE = 1 << 16;
+    static constexpr size_type NUM_CLASSES    = 13;
+    static constexpr size_type CHUNK_SIZE     = 1 << 18;
+
+    // Pools whose cache a thread can look up without a lock
+    static constexpr size_type MAX_THREAD_POOLS = 4;
+
+    explicit PoolAllocator(FreeMode free_mode = FreeMode::CENTRAL);
+    PoolAllocator(const PoolAllocator&) = delete;
+    PoolAllocator& operator=(const PoolAllocator&) = delete;
+    ~PoolAllocator() override;
+
+    void* allocate(size_type n) override;
+    void* allocate(size_type n, size_type alignment) override;
+    void  deallocate(void* p, size_type n) override;
+
+    // Succeeds if both sizes fall in the same size class
+    bool try_expand(void* p, size_type old_n, size_type new_n) override;
+
+    // Served from the thread cache in one go
+    size_type allocate_bulk(size_type count, size_type n, size_type alignment, void** out) override;
+    void deallocate_bulk(size_type count, size_type n, void* const* ptrs) override;
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct FreeList {
+        FreeBlock* head = nullptr;
+        size_type count = 0;
+
+        void push(FreeBlock* block)
+        {
+            block->next = head;
+            head = block;
+            ++count;
+        }
+
+        FreeBlock* pop()
+        {
+            auto block = head;
+            head = block->next;
+            --count;
+            return block;
+        }
+    };
+
+    struct ThreadCache {
+        std::array<FreeList, NUM_CLASSES> lists;
+
+        // Blocks of chunks owned by this thread which were freed by other threads, only used in REMOTE mode
+        std::array<std::atomic<FreeBlock*>, NUM_CLASSES> remote_lists {};
+    };
+
+    // Start of every chunk in REMOTE mode, takes the place of the first block
+    struct ChunkHeader {
+        ThreadCache* owner;
+    };
+
+    struct CentralList {
+        std::mutex mtx;
+        FreeList list;
+    };
+
+    // Flushes the caches of an exiting thread
+    struct ThreadExitGuard;
+    static thread_local ThreadExitGuard m_exit_guard;
+
+    // Cache of the calling thread. Once the thread is exiting and its guard is gone, the shared m_exit_cache instead,
+    // with exit_lock holding m_exit_mtx
+    ThreadCache& thread_cache(std::unique_lock<std::mutex>& exit_lock);
+    ThreadCache& thread_cache_slow(std::unique_lock<std::mutex>& exit_lock);
+
+    // Flush the cache of the calling thread, which is exiting, and leave it for another thread to adopt
+    void release_thread_cache();
+
+    // Move a batch of blocks from the central list (carving a new chunk if needed) into cache, return one of them
+    void* refill(size_type class_idx, ThreadCache& cache);
+
+    // REMOTE mode: take back the remote list (carving a new chunk if it's empty), return one of the blocks
+    void* refill_remote(size_type class_idx, ThreadCache& cache);
+
+    // REMOTE mode: push block to the cache if it's ours, or to the remote list of its owner
+    void free_remote(size_type class_idx, ThreadCache& cache, FreeBlock* block);
+
+    // Return count blocks from cache to the central list
+    void flush(size_type class_idx, FreeList& cache, size_type count);
+
+    std::array<CentralList, NUM_CLASSES> m_central;
+
+    // Guards m_chunks and m_caches. A cache whose thread has exited has a default constructed id
+    std::mutex m_mtx;
+    std::vector<void*> m_chunks;
+    std::vector<std::pair<std::thread::id, std::unique_ptr<ThreadCache>>> m_caches;
+
+    // Used by threads which free or allocate while they exit, after their caches have been released
+    std::mutex m_exit_mtx;
+    ThreadCache m_exit_cache;
+
+    const std::uint64_t m_id;
+    const FreeMode m_free_mode;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// ArenaAllocator
+// Monotonic allocator, bump-allocates from large chunks and ignores deallocate. Everything is released at once by
+// reset() or the destructor, at a cost proportional to the number of chunks rather than allocations.
+class ArenaAllocator : public Allocator {
+public:
+    static constexpr size_type DEFAULT_CHUNK_SIZE = 1 << 20;
+
+    explicit ArenaAllocator(size_type chunk_size = DEFAULT_CHUNK_SIZE);
+    ArenaAllocator(const ArenaAllocator&) = delete;
+    ArenaAllocator& operator=(const ArenaAllocator&) = delete;
+    ~ArenaAllocator() override;
+
+    void* allocate(size_type n) override;
+    void* allocate(size_type n, size_type alignment) override;
+    void  deallocate(void*, size_type) override {}
+
+    // Succeeds for the most recent allocation if the current chunk has room
+    bool try_expand(void* p, size_type old_n, size_type new_n) override;
+
+    // Drop all allocations, the most recent chunk is kept for reuse
+    void reset();
+
+    // Bytes handed out since construction or last reset
+    size_type used() const { return m_used; }
+
+private:
+    struct Chunk {
+        Chunk* prev;
+    };
+
+    static constexpr size_type CHUNK_HEADER_SIZE = (size_of<Chunk> + MIN_ALIGNMENT - 1) & ~(MIN_ALIGNMENT - 1);
+
+    void* allocate_from_new_chunk(size_type n, size_type alignment);
+
+    Chunk* m_chunk = nullptr;
+    char* m_current = nullptr;
+    char* m_end = nullptr;
+    size_type m_used = 0;
+    size_type m_chunk_size;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// StackAllocator
+// Bump allocator over one fixed buffer for scratch memory used in LIFO order, e.g. temporaries of one frame.
+// deallocate() frees the most recent allocation, anything else is reclaimed by rewinding to a mark() taken earlier.
+// Padding is not tracked, so blocks older than an over-aligned one that needed padding are only reclaimed by rewind().
+// Returns nullptr when the buffer is full.
+// Debug builds keep a shadow stack of live blocks and assert on out of order frees. Not thread safe.
+class StackAllocator : public Allocator {
+public:
+    using Marker = size_type;
+
+    explicit StackAllocator(size_type capacity);
+    StackAllocator(const StackAllocator&) = delete;
+    StackAllocator& operator=(const StackAllocator&) = delete;
+    ~StackAllocator() override;
+
+    void* allocate(size_type n) override
+    {
+        return StackAllocator::allocate(n, MIN_ALIGNMENT);
+    }
+
+    void* allocate(size_type n, size_type alignment) override
+    {
+        const auto mask = static_cast<std::uintptr_t>(std::max(MIN_ALIGNMENT, alignment) - 1);
+        const auto p = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(m_top) + mask) & ~mask);
+        if (stack_size(n) > m_end - p) {
+            return nullptr;
+        }
+
+#ifndef NDEBUG
+        m_live.push_back(p);
+#endif
+        m_top = p + stack_size(n);
+        return p;
+    }
+
+    void deallocate(void* p, size_type n) override
+    {
+        const auto block = static_cast<char*>(p);
+        if (block == nullptr) {
+            return;
+        }
+
+#ifndef NDEBUG
+        // Out of order free
+        ASSERT(!m_live.empty() && m_live.back() == block);
+        m_live.pop_back();
+#endif
+        if (block + stack_size(n) == m_top) {
+            m_top = block;
+        }
+    }
+
+    // Succeeds for the most recent allocation if the buffer has room
+    bool try_expand(void* p, size_type old_n, size_type new_n) override
+    {
+        const auto block = static_cast<char*>(p);
+        if (block + stack_size(old_n) != m_top || stack_size(new_n) > m_end - block) {
+            return new_n == old_n;
+        }
+
+        m_top = block + stack_size(new_n);
+        return true;
+    }
+
+    Marker mark() const { return m_top - m_begin; }
+
+    // Free everything allocated since marker was taken
+    void rewind(Marker marker)
+    {
+        ASSERT(marker >= 0 && marker <= mark());
+        m_top = m_begin + marker;
+
+#ifndef NDEBUG
+        while (!m_live.empty() && m_live.back() >= m_top) {
+            m_live.pop_back();
+        }
+#endif
+    }
+
+    size_type used() const { return m_top - m_begin; }
+    size_type capacity() const { return m_end - m_begin; }
+
+private:
+    // Blocks are rounded up so that the next one needs no padding unless it is over-aligned
+    static size_type stack_size(size_type n) { return (n + MIN_ALIGNMENT - 1) & ~(MIN_ALIGNMENT - 1); }
+
+    char* m_begin;
+    char* m_top;
+    char* m_end;
+
+#ifndef NDEBUG
+    std::vector<char*> m_live;
+#endif
+};
+
+// Two stacks growing towards each other in one buffer, e.g. one for data that lives across frames and one for
+// temporaries. allocate() takes from the bottom, allocate_top() from the top, and deallocate() frees from whichever
+// end the block came from, with the same LIFO rules as StackAllocator. Markers are per end.
+class DoubleStackAllocator : public Allocator {
+public:
+    using Marker = size_type;
+
+    explicit DoubleStackAllocator(size_type capacity);
+    DoubleStackAllocator(const DoubleStackAllocator&) = delete;
+    DoubleStackAllocator& operator=(const DoubleStackAllocator&) = delete;
+    ~DoubleStackAllocator() override;
+
+    void* allocate(size_type n) override
+    {
+        return DoubleStackAllocator::allocate(n, MIN_ALIGNMENT);
+    }
+
+    void* allocate(size_type n, size_type alignment) override
+    {
+        const auto mask = static_cast<std::uintptr_t>(std::max(MIN_ALIGNMENT, alignment) - 1);
+        const auto p = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(m_bottom) + mask) & ~mask);
+        if (stack_size(n) > m_top - p) {
+            return nullptr;
+        }
+
+#ifndef NDEBUG
+        m_live_bottom.push_back(p);
+#endif
+        m_bottom = p + stack_size(n);
+        return p;
+    }
+
+    void* allocate_top(size_type n, size_type alignment = MIN_ALIGNMENT)
+    {
+        const auto mask = static_cast<std::uintptr_t>(std::max(MIN_ALIGNMENT, alignment) - 1);
+        if (stack_size(n) > m_top - m_bottom) {
+            return nullptr;
+        }
+
+        const auto p = reinterpret_cast<char*>(reinterpret_cast<std::uintptr_t>(m_top - stack_size(n)) & ~mask);
+        if (p < m_bottom) {
+            return nullptr;
+        }
+
+#ifndef NDEBUG
+        m_live_top.push_back(p);
+#endif
+        m_top = p;
+        return p;
+    }
+
+    void deallocate(void* p, size_type n) override
+    {
+        const auto block = static_cast<char*>(p);
+        if (block == nullptr) {
+            return;
+        }
+
+        // Blocks of the bottom stack are all below m_bottom, those of the top stack at or above m_top
+        if (block < m_bottom) {
+#ifndef NDEBUG
+            ASSERT(!m_live_bottom.empty() && m_live_bottom.back() == block);
+            m_live_bottom.pop_back();
+#endif
+            if (block + stack_size(n) == m_bottom) {
+                m_bottom = block;
+            }
+        } else {
+#ifndef NDEBUG
+            ASSERT(!m_live_top.empty() && m_live_top.back() == block);
+            m_live_top.pop_back();
+#endif
+            if (block == m_top) {
+                m_top = block + stack_size(n);
+            }
+        }
+    }
+
+    Marker mark_bottom() const { return m_bottom - m_begin; }
+    Marker mark_top() const { return m_end - m_top; }
+
+    void rewind_bottom(Marker marker)
+    {
+        ASSERT(marker >= 0 && marker <= mark_bottom());
+        m_bottom = m_begin + marker;
+
+#ifndef NDEBUG
+        while (!m_live_bottom.empty() && m_live_bottom.back() >= m_bottom) {
+            m_live_bottom.pop_back();
+        }
+#endif
+    }
+
+    void rewind_top(Marker marker)
+    {
+        ASSERT(marker >= 0 && marker <= mark_top());
+        m_top = m_end - marker;
+
+#ifndef NDEBUG
+        while (!m_live_top.empty() && m_live_top.back() < m_top) {
+            m_live_top.pop_back();
+        }
+#endif
+    }
+
+    size_type used() const { return (m_bottom - m_begin) + (m_end - m_top); }
+    size_type capacity() const { return m_end - m_begin; }
+
+private:
+    static size_type stack_size(size_type n) { return (n + MIN_ALIGNMENT - 1) & ~(MIN_ALIGNMENT - 1); }
+
+    char* m_begin;
+    char* m_bottom;
+    char* m_top;
+    char* m_end;
+
+#ifndef NDEBUG
+    std::vector<char*> m_live_bottom;
+    std::vector<char*> m_live_top;
+#endif
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// SlabAllocator
+// Fixed size blocks carved from slabs, recycled through a lock-free free list so any number of threads may allocate
+// and free concurrently, including freeing blocks allocated by another thread. Blocks are addressed by a 32 bit index
+// which is packed with a 32 bit tag into the list head, this prevents ABA with a plain 64 bit CAS.
+// Only requests of exactly block_size() bytes are served from slabs, anything else goes to DefaultAllocator. Blocks are
+// aligned to at least MIN_ALIGNMENT, as allocate(n) promises, whatever the alignment given.
+class SlabAllocator : public Allocator {
+public:
+    static constexpr size_type MIN_SLAB_SIZE = 1 << 16;
+    static constexpr size_type MAX_SLABS     = 1 << 12;
+
+    explicit SlabAllocator(size_type block_size, size_type alignment = MIN_ALIGNMENT);
+    SlabAllocator(const SlabAllocator&) = delete;
+    SlabAllocator& operator=(const SlabAllocator&) = delete;
+    ~SlabAllocator() override;
+
+    void* allocate(size_type n) override;
+    void* allocate(size_type n, size_type alignment) override;
+    void  deallocate(void* p, size_type n) override;
+
+    size_type block_size() const { return m_block_size; }
+
+private:
+    using Index = std::uint32_t;
+
+    struct SlabHeader {
+        Index slab_idx;
+    };
+
+    void* pop();
+    void  push(void* p);
+
+    // Allocate a new slab and push all of its blocks, return false if we are out of slabs or memory
+    bool grow();
+
+    char* block_ptr(Index idx) const;
+    Index block_index(void* p) const;
+
+    static std::atomic<Index>& next_of(void* block) { return *static_cast<std::atomic<Index>*>(block); }
+
+    const size_type m_block_size;
+    const size_type m_alignment;
+    const size_type m_stride;
+    const size_type m_slab_size;
+    const size_type m_header_size;
+    const size_type m_blocks_per_slab;
+
+    // Low 32 bits: index + 1 of the first free block (0 if empty), high 32 bits: tag bumped by every update
+    std::atomic<std::uint64_t> m_head {0};
+
+    std::mutex m_grow_mtx;
+    std::atomic<size_type> m_num_slabs {0};
+    std::unique_ptr<std::atomic<char*>[]> m_slabs;
+    DefaultAllocator m_upstream;
+};
+
+// Slab allocator for arrays of COUNT Ts, e.g. Deque subarrays, default constructible for StaticAllocatorPolicy
+template <typename T, size_type COUNT>
+class TypedSlabAllocator : public SlabAllocator {
+public:
+    TypedSlabAllocator() : SlabAllocator {size_of<T> * COUNT, align_of<T>} {}
+};
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// HugePageAllocator
+// Carve blocks out of large regions backed by huge pages to cut TLB misses on big containers. Regions are mapped with
+// MAP_HUGETLB when hugetlbfs has pages reserved, otherwise mapped normally and advised with MADV_HUGEPAGE so that
+// transparent huge pages can back them. Freed blocks are kept in power-of-two size class lists for reuse, requests
+// whose class is larger than a region get a mapping of their own. Thread safe, guarded by a mutex.
+class HugePageAllocator : public Allocator {
+public:
+    enum class Mode {HUGETLB, TRANSPARENT, NONE};
+
+    static constexpr size_type HUGE_PAGE_SIZE      = 1 << 21;
+    static constexpr size_type DEFAULT_REGION_SIZE = 1 << 26;
+    static constexpr size_type MAX_BLOCK_ALIGNMENT = 1 << 12;
+
+    explicit HugePageAllocator(size_type region_size = DEFAULT_REGION_SIZE);
+    HugePageAllocator(const HugePageAllocator&) = delete;
+    HugePageAllocator& operator=(const HugePageAllocator&) = delete;
+    ~HugePageAllocator() override;
+
+    void* allocate(size_type n) override;
+    void* allocate(size_type n, size_type alignment) override;
+    void  deallocate(void* p, size_type n) override;
+
+    // How the most recently mapped region is backed
+    Mode mode() const { return m_mode.load(std::memory_order_relaxed); }
+    static const char* mode_name(Mode mode);
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct Region {
+        void* data;
+        size_type size;
+    };
+
+    static constexpr size_type NUM_CLASSES = 40;
+
+    // Map size bytes, rounded up to HUGE_PAGE_SIZE, update m_mode. Return nullptr on failure.
+    void* map_region(size_type size);
+    static void unmap_region(const Region& region);
+
+    std::mutex m_mtx;
+    std::array<FreeBlock*, NUM_CLASSES> m_free_lists {};
+    std::vector<Region> m_regions;
+    char* m_current = nullptr;
+    char* m_end = nullptr;
+
+    const size_type m_region_size;
+    std::atomic<Mode> m_mode {Mode::HUGETLB};
+
+    // Set once MAP_HUGETLB has failed, so we don't try it again for every region
+    bool m_hugetlb_failed = false;
+};
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// MmapFileAllocator
+// Allocate from a memory-mapped file which grows on demand, so containers larger than RAM spill to disk through the
+// page cache and survive a restart. All bookkeeping is kept in the file as offsets: a header at the start, then
+// blocks in power-of-two size classes with a free list per class, like HugePageAllocator.
+//
+// A range of capacity bytes of address space is reserved up front and the file is mapped at its start, so blocks
+// never move while the file grows. When a file is reopened we ask for the address it was mapped at before. If we
+// get it, same_address() is true and raw pointers stored in the file, e.g. a whole Deque placed in root(), are still
+// valid. Otherwise only offsets are meaningful. Thread safe, guarded by a mutex. POSIX only.
+class MmapFileAllocator : public Allocator {
+public:
+    static constexpr size_type DEFAULT_CAPACITY    = size_type {1} << 36;
+    static constexpr size_type GROW_SIZE           = 1 << 26;
+    static constexpr size_type MAX_BLOCK_ALIGNMENT = 1 << 12;
+
+    // Open the file at path or create it. Throw std::runtime_error if it can't be opened and mapped, or if it is not
+    // a file written by MmapFileAllocator.
+    explicit MmapFileAllocator(const std::string& path, size_type capacity = DEFAULT_CAPACITY);
+    MmapFileAllocator(const MmapFileAllocator&) = delete;
+    MmapFileAllocator& operator=(const MmapFileAllocator&) = delete;
+    ~MmapFileAllocator() override;
+
+    void* allocate(size_type n) override;
+    void* allocate(size_type n, size_type alignment) override;
+    void  deallocate(void* p, size_type n) override;
+
+    // Entry point for the application to find its data after reopening, nullptr for a new file
+    void* root() const;
+    void set_root(void* p);
+
+    bool same_address() const { return m_same_address; }
+
+    size_type offset_of(const void* p) const { return static_cast<const char*>(p) - m_base; }
+    void* address_of(size_type offset) const { return m_base + offset; }
+
+    // Current size of the file
+    size_type size() const;
+
+    // Write dirty pages back to the file
+    void sync();
+
+private:
+    static constexpr size_type NUM_CLASSES = 48;
+
+    // Start of the file, offsets are relative to the start of the file, 0 means none
+    struct Header {
+        std::uint64_t magic;
+        std::uint32_t version;
+        std::uint32_t reserved;
+        std::uint64_t base_address;
+        std::uint64_t size;
+        std::uint64_t top;
+        std::uint64_t root;
+        std::array<std::uint64_t, NUM_CLASSES> free_lists;
+    };
+
+    Header& header() const { return *reinterpret_cast<Header*>(m_base); }
+
+    // Grow the file and the mapping to at least size bytes, return false if it doesn't fit in capacity
+    bool grow(size_type size);
+
+    // Guards the header
+    mutable std::mutex m_mtx;
+    int m_fd = -1;
+    char* m_base = nullptr;
+    size_type m_capacity = 0;
+    bool m_same_address = true;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// StatsAllocator
+// Decorator which forwards to another allocator and counts what goes through it, cheap enough for release builds.
+// Counters are sharded per thread and updated with relaxed atomics. The high-water mark of live bytes is only updated
+// when a thread's own live bytes reach a new high, so it can miss a peak built up by several threads together.
+struct AllocStats {
+    static constexpr size_type NUM_SIZE_BUCKETS = 32;
+
+    size_type num_allocs       = 0;
+    size_type num_deallocs     = 0;
+    size_type bytes_allocated  = 0;
+    size_type bytes_freed      = 0;
+    size_type bytes_live       = 0;
+    size_type peak_bytes_live  = 0;
+
+    // Bucket i counts allocations of (2^(i-1), 2^i] bytes, the last bucket takes everything larger
+    std::array<size_type, NUM_SIZE_BUCKETS> size_histogram {};
+
+    void report(std::ostream& os) const;
+};
+
+class StatsAllocator : public Allocator {
+public:
+    static constexpr size_type NUM_THREAD_SLOTS = 64;
+
+    explicit StatsAllocator(Allocator& upstream) : m_upstream {upstream} {}
+    StatsAllocator(const StatsAllocator&) = delete;
+    StatsAllocator& operator=(const StatsAllocator&) = delete;
+
+    void* allocate(size_type n) override;
+    void* allocate(size_type n, size_type alignment) override;
+    void  deallocate(void* p, size_type n) override;
+
+    bool try_expand(void* p, size_type old_n, size_type new_n) override;
+    size_type allocate_bulk(size_type count, size_type n, size_type alignment, void** out) override;
+    void deallocate_bulk(size_type count, size_type n, void* const* ptrs) override;
+
+    // Totals over all threads
+    AllocStats snapshot() const;
+
+    // Per-thread counters. Threads are given a slot in order of their first allocation through any StatsAllocator,
+    // slots are shared once there are more than NUM_THREAD_SLOTS threads. Slots may have negative bytes_live if
+    // blocks are freed by another thread. peak_bytes_live is only tracked in total.
+    std::vector<AllocStats> thread_snapshots() const;
+
+    void report(std::ostream& os) const { snapshot().report(os); }
+
+private:
+    struct alignas(CACHE_LINE_SIZE) ThreadSlot {
+        std::atomic<size_type> num_allocs {0};
+        std::atomic<size_type> num_deallocs {0};
+        std::atomic<size_type> bytes_allocated {0};
+        std::atomic<size_type> bytes_freed {0};
+        std::atomic<size_type> peak_bytes_live {0};
+        std::array<std::atomic<size_type>, AllocStats::NUM_SIZE_BUCKETS> size_histogram {};
+
+        void add_to(AllocStats& stats) const;
+    };
+
+    ThreadSlot& thread_slot();
+    void record_allocate(size_type count, size_type n);
+    void record_deallocate(size_type count, size_type n);
+
+    Allocator& m_upstream;
+    std::array<ThreadSlot, NUM_THREAD_SLOTS> m_slots;
+    std::atomic<size_type> m_peak_bytes_live {0};
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// TracingAllocator
+// Decorator which forwards to another allocator and logs every event to a binary trace file, to be replayed against
+// other allocators later by replay_alloc_trace. The file is an AllocTraceHeader followed by AllocTraceRecords in the
+// order the events happened. Events are buffered under a mutex, so this is meant for capturing traces, not production.
+struct AllocTraceHeader {
+    static constexpr std::uint64_t MAGIC   = 0x45434152'54534c43; // "CLSTRACE"
+    static constexpr std::uint32_t VERSION = 1;
+
+    std::uint64_t magic       = MAGIC;
+    std::uint32_t version     = VERSION;
+    std::uint32_t record_size = 32;
+};
+
+struct AllocTraceRecord {
+    enum Op : std::uint8_t {ALLOCATE, DEALLOCATE, EXPAND};
+
+    std::uint64_t timestamp;      // ns since the trace was opened
+    std::uint64_t address;
+    std::uint64_t size;           // New size for EXPAND
+    std::uint32_t thread;         // Threads are numbered in order of their first event
+    std::uint8_t  alignment_log2; // 0 for allocate() without alignment
+    std::uint8_t  op;
+    std::uint16_t reserved;
+};
+
+static_assert(sizeof(AllocTraceRecord) == 32, "AllocTraceRecord must be packed");
+
+// Read a whole trace file, throw std::runtime_error if it's not a valid trace
+std::vector<AllocTraceRecord> read_alloc_trace(const std::string& path);
+
+class TracingAllocator : public Allocator {
+public:
+    static constexpr size_type BUFFER_SIZE = 4096;
+
+    // Throw std::runtime_error if the file can't be created
+    TracingAllocator(Allocator& upstream, const std::string& path);
+    TracingAllocator(const TracingAllocator&) = delete;
+    TracingAllocator& operator=(const TracingAllocator&) = delete;
+    ~TracingAllocator() override;
+
+    void* allocate(size_type n) override;
+    void* allocate(size_type n, size_type alignment) override;
+    void  deallocate(void* p, size_type n) override;
+
+    bool try_expand(void* p, size_type old_n, size_type new_n) override;
+    size_type allocate_bulk(size_type count, size_type n, size_type alignment, void** out) override;
+    void deallocate_bulk(size_type count, size_type n, void* const* ptrs) override;
+
+    // Write buffered events to the file
+    void flush();
+
+private:
+    void record(AllocTraceRecord::Op op, const void* p, size_type n, size_type alignment);
+    void flush_locked();
+
+    Allocator& m_upstream;
+    std::ofstream m_file;
+    const std::chrono::steady_clock::time_point m_start;
+
+    std::mutex m_mtx;
+    std::vector<AllocTraceRecord> m_buffer;
+};
 CLS_END
@@ -24,19 +24,45 @@
 
 #pragma once
 
+#include <array>
 #include <cstddef>
+#include <cstring>
 #include <vector>
 #include <algorithm>
 #include "cls/traits.hpp"
 #include "allocator.h"
 
 CLS_BEGIN
+// Types which can be moved to another address by copying their bytes, after which the source counts as destroyed.
+// Deque shifts such elements with memmove. Specialize it for types holding e.g. a unique_ptr or a std::vector, but
+// not for types pointing into themselves, like a std::string with small string optimization
+template <typename T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
 namespace detail {
 template <typename T>
 constexpr size_type DEFAULT_SUBARRAY_SIZE =
     sizeof(T) <= 4 ? 512 : sizeof(T) <= 8 ? 256 : sizeof(T) <= 16 ? 128 : sizeof(T) <= 32 ? 64 : 32;
 constexpr size_type MIN_PTR_ARRAY_SIZE = 8;
 
+// Emptied subarrays a Deque keeps for reuse, by default and at most
+constexpr size_type DEFAULT_SPARE_SUBARRAYS = 2;
+constexpr size_type MAX_SPARE_SUBARRAYS = 8;
+
+// Max number of subarrays allocated with one bulk allocation
+constexpr size_type SUBARRAY_BULK_SIZE = 64;
+
+// log2 of a subarray size, which is a power of 2
+constexpr size_type subarray_shift(size_type subarray_size)
+{
+    size_type shift = 0;
+    while ((size_type {1} << shift) < subarray_size) {
+        ++shift;
+    }
+
+    return shift;
+}
+
 template <typename ContainerT>
 inline auto make_view(ContainerT& container)
 {
@@ -57,75 +83,130 @@ inline auto make_view(Iterator first, Iterator last)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // SubarrayT
-template <typename T, size_type SIZE>
-class SubarrayT {
-    struct Deletor {
-        void operator()(T* p)
-        {
-            dealloc_memory(ActiveAllocator::get(), p, size_of<T> * SIZE);
-        }
-    };
-
-    std::unique_ptr<T[], Deletor> m_storage;
+// A subarray is a single block of SIZE elements, the pointer array points straight at it
+template <typename T, size_type SIZE, typename Alloc = ActiveAllocatorPolicy>
+struct SubarrayT {
+    static constexpr size_type BLOCK_SIZE = size_of<T> * SIZE;
 
-public:
-    SubarrayT()
+    static T* allocate()
     {
-        auto p = alloc_array<T>(ActiveAllocator::get(), SIZE);
+        Alloc alloc;
+        auto p = alloc_array<T>(alloc, SIZE);
         if (p == nullptr) {
             throw std::bad_alloc {};
         }
 
-        m_storage.reset(p);
+        return p;
     }
 
-    static void* operator new(size_t n)
+    static void deallocate(T* p)
     {
-        return alloc_memory(ActiveAllocator::get(), static_cast<size_type>(n), align_of<SubarrayT>);
+        Alloc alloc;
+        dealloc_memory(alloc, p, BLOCK_SIZE);
     }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// PtrArrayT
+// Array of subarray pointers, tries to resize in place before it reallocates
+template <typename T, typename Alloc>
+class PtrArrayT {
+public:
+    using value_type = T;
+    using pointer    = T*;
+
+    PtrArrayT() = default;
+    PtrArrayT(const PtrArrayT&) = delete;
+    PtrArrayT& operator=(const PtrArrayT&) = delete;
 
-    static void operator delete(void* p)
+    ~PtrArrayT()
     {
-        dealloc_memory(ActiveAllocator::get(), p, size_of<SubarrayT>);
+        resize(0);
     }
 
-    T* data() { return m_storage.get(); }
+    T* data() { return m_data; }
+    const T* data() const { return m_data; }
+
+    T* begin() { return m_data; }
+    T* end() { return m_data + m_size; }
 
-    T* begin() { return m_storage.get(); }
-    const T* begin() const { return m_storage.get(); }
+    size_type size() const { return m_size; }
 
-    T* end() { return m_storage.get() + SIZE; }
-    const T* end() const { return m_storage.get() + SIZE; }
+    void resize(size_type n)
+    {
+        if (n == m_size) {
+            return;
+        }
+
+        Alloc alloc;
+        const auto old_size = m_size;
+        if (n < old_size) {
+            std::for_each(m_data + n, m_data + old_size, [](T& ptr) { destroy(&ptr); });
+        }
+
+        if (n == 0) {
+            dealloc_memory(alloc, m_data, old_size * size_of<T>);
+            m_data = nullptr;
+        } else if (m_data != nullptr && expand_memory(alloc, m_data, old_size * size_of<T>, n * size_of<T>)) {
+            std::for_each(m_data + std::min(n, old_size), m_data + n, [](T& ptr) { construct(&ptr); });
+        } else {
+            auto new_data = alloc_array<T>(alloc, n);
+            if (new_data == nullptr) {
+                throw std::bad_alloc {};
+            }
+
+            const auto num_moved = std::min(n, old_size);
+            std::uninitialized_copy(std::make_move_iterator(m_data), std::make_move_iterator(m_data + num_moved),
+                                    new_data);
+            std::for_each(new_data + num_moved, new_data + n, [](T& ptr) { construct(&ptr); });
+            std::for_each(m_data, m_data + num_moved, [](T& ptr) { destroy(&ptr); });
+            if (m_data != nullptr) {
+                dealloc_memory(alloc, m_data, old_size * size_of<T>);
+            }
+            m_data = new_data;
+        }
+
+        m_size = n;
+    }
+
+    void swap(PtrArrayT& rhs) noexcept
+    {
+        std::swap(m_data, rhs.m_data);
+        std::swap(m_size, rhs.m_size);
+    }
+
+private:
+    T* m_data = nullptr;
+    size_type m_size = 0;
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // DequeIterator
-template <typename T, typename Pointer, typename Reference, size_type SUBARRAY_SIZE>
+template <typename T, typename Pointer, typename Reference, size_type SUBARRAY_SIZE, typename Alloc>
 struct DequeIterator {
-    using this_type         = DequeIterator<T, Pointer, Reference, SUBARRAY_SIZE>;
-    using iterator          = DequeIterator<T, T*, T&, SUBARRAY_SIZE>;
-    using const_iterator    = DequeIterator<T, const T*, const T&, SUBARRAY_SIZE>;
+    using this_type         = DequeIterator<T, Pointer, Reference, SUBARRAY_SIZE, Alloc>;
+    using iterator          = DequeIterator<T, T*, T&, SUBARRAY_SIZE, Alloc>;
+    using const_iterator    = DequeIterator<T, const T*, const T&, SUBARRAY_SIZE, Alloc>;
     using difference_type   = std::ptrdiff_t;
     using iterator_category = std::random_access_iterator_tag;
     using value_type        = T;
     using pointer           = Pointer;
     using reference         = Reference;
-    using Subarray          = SubarrayT<T, SUBARRAY_SIZE>;
-    using SubarrayPtr       = std::unique_ptr<SubarrayT<T, SUBARRAY_SIZE>>;
+    using SubarrayPtr       = T*;
 
-    template <typename, typename, typename, size_type>
+    template <typename, typename, typename, size_type, typename>
     friend struct DequeIterator;
 
-    template <typename, size_type>
+    template <typename, size_type, typename>
     friend class DequeImpl;
 
-    template <typename, size_type>
+    template <typename, size_type, typename>
     friend class Deque;
 
     DequeIterator() = default;
 
     // Support construct/assign const_iterator from iterator
-    operator const_iterator()
+    operator const_iterator() const
     {
         return const_iterator {m_current, m_subarray};
     }
@@ -213,7 +294,7 @@ struct DequeIterator {
     }
 
     template <typename U, typename PointerU, typename ReferenceU>
-    difference_type operator-(const DequeIterator<U, PointerU, ReferenceU, SUBARRAY_SIZE>& x) const
+    difference_type operator-(const DequeIterator<U, PointerU, ReferenceU, SUBARRAY_SIZE, Alloc>& x) const
     {
         return SUBARRAY_SIZE * (m_subarray - x.m_subarray - 1) +
             (m_current - sub_begin()) + (x.sub_end() - x.m_current);
@@ -222,37 +303,37 @@ struct DequeIterator {
     ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
     // Comparison
     template <typename U, typename PointerU, typename ReferenceU>
-    bool operator==(const DequeIterator<U, PointerU, ReferenceU, SUBARRAY_SIZE>& rhs) const
+    bool operator==(const DequeIterator<U, PointerU, ReferenceU, SUBARRAY_SIZE, Alloc>& rhs) const
     {
         return m_current == rhs.m_current;
     }
 
     template <typename U, typename PointerU, typename ReferenceU>
-    bool operator!=(const DequeIterator<U, PointerU, ReferenceU, SUBARRAY_SIZE>& rhs) const
+    bool operator!=(const DequeIterator<U, PointerU, ReferenceU, SUBARRAY_SIZE, Alloc>& rhs) const
     {
         return m_current != rhs.m_current;
     }
 
     template <typename U, typename PointerU, typename ReferenceU>
-    bool operator<(const DequeIterator<U, PointerU, ReferenceU, SUBARRAY_SIZE>& rhs) const
+    bool operator<(const DequeIterator<U, PointerU, ReferenceU, SUBARRAY_SIZE, Alloc>& rhs) const
     {
         return m_subarray == rhs.m_subarray ? m_current < rhs.m_current : m_subarray < rhs.m_subarray;
     }
 
     template <typename U, typename PointerU, typename ReferenceU>
-    bool operator>(const DequeIterator<U, PointerU, ReferenceU, SUBARRAY_SIZE>& rhs) const
+    bool operator>(const DequeIterator<U, PointerU, ReferenceU, SUBARRAY_SIZE, Alloc>& rhs) const
     {
         return m_subarray == rhs.m_subarray ? m_current > rhs.m_current : m_subarray > rhs.m_subarray;
     }
 
     template <typename U, typename PointerU, typename ReferenceU>
-    bool operator<=(const DequeIterator<U, PointerU, ReferenceU, SUBARRAY_SIZE>& rhs) const
+    bool operator<=(const DequeIterator<U, PointerU, ReferenceU, SUBARRAY_SIZE, Alloc>& rhs) const
     {
         return *this == rhs || *this < rhs;
     }
 
     template <typename U, typename PointerU, typename ReferenceU>
-    bool operator>=(const DequeIterator<U, PointerU, ReferenceU, SUBARRAY_SIZE>& rhs) const
+    bool operator>=(const DequeIterator<U, PointerU, ReferenceU, SUBARRAY_SIZE, Alloc>& rhs) const
     {
         return *this == rhs || *this > rhs;
     }
@@ -273,17 +354,12 @@ public:
 
     T* sub_begin() const
     {
-        return m_subarray->get()->begin();
+        return *m_subarray;
     }
 
     T* sub_end() const
     {
-        return m_subarray->get()->end();
-    }
-
-    Subarray* subarray() const
-    {
-        return m_subarray->get();
+        return *m_subarray + SUBARRAY_SIZE;
     }
 
     this_type copy(const iterator& first, const iterator& last)
@@ -338,29 +414,106 @@ protected:
 
 
 // Support integer + iterator
-template <typename T, typename Pointer, typename Reference, size_type SUBARRAY_SIZE>
-auto operator+(std::ptrdiff_t n, const DequeIterator<T, Pointer, Reference, SUBARRAY_SIZE>& x)
+template <typename T, typename Pointer, typename Reference, size_type SUBARRAY_SIZE, typename Alloc>
+auto operator+(std::ptrdiff_t n, const DequeIterator<T, Pointer, Reference, SUBARRAY_SIZE, Alloc>& x)
 {
     return x + n;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-// DequeImpl
+// DequeSegments
+// Range over the elements of a Deque one subarray at a time, each segment is a gsl::span of contiguous elements. T is
+// const for a const Deque
 template <typename T, size_type SUBARRAY_SIZE>
+class DequeSegments {
+    struct Bounds {
+        T* const* first_subarray;
+        T* const* last_subarray;
+        T* first;
+        T* last;
+    };
+
+public:
+    class iterator {
+    public:
+        using difference_type   = std::ptrdiff_t;
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = gsl::span<T>;
+        using pointer           = void;
+        using reference         = value_type;
+
+        iterator(const Bounds& bounds, T* const* subarray) : m_bounds {bounds}, m_subarray {subarray} {}
+
+        auto operator*() const -> value_type
+        {
+            auto first = m_subarray == m_bounds.first_subarray ? m_bounds.first : *m_subarray;
+            auto last = m_subarray == m_bounds.last_subarray ? m_bounds.last : *m_subarray + SUBARRAY_SIZE;
+            return value_type {first, last};
+        }
+
+        iterator& operator++()
+        {
+            ++m_subarray;
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            iterator tmp = *this;
+            ++m_subarray;
+
+            return tmp;
+        }
+
+        bool operator==(const iterator& rhs) const { return m_subarray == rhs.m_subarray; }
+        bool operator!=(const iterator& rhs) const { return m_subarray != rhs.m_subarray; }
+
+    private:
+        Bounds m_bounds;
+        T* const* m_subarray;
+    };
+
+    // Elements [first, last), first is in *first_subarray and last in *last_subarray
+    DequeSegments(T* const* first_subarray, T* const* last_subarray, T* first, T* last)
+        : m_bounds {first_subarray, last_subarray, first, last}
+    {
+        if (first == last) {
+            // No segment at all
+            m_bounds.first_subarray = last_subarray + 1;
+        } else if (last == *last_subarray) {
+            // No empty segment at the end
+            m_bounds.last_subarray = last_subarray - 1;
+            m_bounds.last = *m_bounds.last_subarray + SUBARRAY_SIZE;
+        }
+    }
+
+    iterator begin() const { return iterator {m_bounds, m_bounds.first_subarray}; }
+    iterator end() const { return iterator {m_bounds, m_bounds.last_subarray + 1}; }
+
+    size_type size() const { return (m_bounds.last_subarray + 1) - m_bounds.first_subarray; }
+    bool empty() const { return size() == 0; }
+
+private:
+    Bounds m_bounds;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// DequeImpl
+template <typename T, size_type SUBARRAY_SIZE, typename Alloc>
 class DequeImpl {
 public:
-    using Subarray    = SubarrayT<T, SUBARRAY_SIZE>;
-    using SubarrayPtr = std::unique_ptr<Subarray>;
+    using Subarray    = SubarrayT<T, SUBARRAY_SIZE, Alloc>;
+    using SubarrayPtr = T*;
 
-    using this_type       = DequeImpl<T, SUBARRAY_SIZE>;
+    using this_type       = DequeImpl<T, SUBARRAY_SIZE, Alloc>;
     using value_type      = T;
     using pointer         = T*;
     using const_pointer   = const T*;
     using reference       = T&;
     using const_reference = const T&;
     using difference_type = std::ptrdiff_t;
-    using iterator        = DequeIterator<T, T*, T&, SUBARRAY_SIZE>;
-    using const_iterator  = DequeIterator<T, const T*, const T&, SUBARRAY_SIZE>;
+    using iterator        = DequeIterator<T, T*, T&, SUBARRAY_SIZE, Alloc>;
+    using const_iterator  = DequeIterator<T, const T*, const T&, SUBARRAY_SIZE, Alloc>;
     using reverse_iterator       = std::reverse_iterator<iterator>;
     using const_reverse_iterator = std::reverse_iterator<const_iterator>;
 
@@ -378,6 +531,8 @@ public:
     ~DequeImpl()
     {
         destruct(m_begin, m_end);
+        free_subarrays(m_ptr_array.begin(), m_ptr_array.end());
+        free_subarrays(m_spare.data(), m_spare.data() + m_num_spare);
     }
 
     void assign(size_type n, const value_type& value)
@@ -420,16 +575,16 @@ public:
     auto at(size_type n) -> reference
     {
         if (n < 0 || n >= size()) throw std::out_of_range {"index is out of range!"};
-        return *(m_begin + n);
+        return *element_at(n);
     }
     auto at(size_type n) const -> const_reference
     {
         if (n < 0 || n >= size()) throw std::out_of_range {"index is out of range!"};
-        return *(m_begin + n);
+        return *element_at(n);
     }
 
-    auto operator[](size_type n) -> reference { return *(m_begin + n); }
-    auto operator[](size_type n) const -> const_reference { return *(m_begin + n); }
+    auto operator[](size_type n) -> reference { return *element_at(n); }
+    auto operator[](size_type n) const -> const_reference { return *element_at(n); }
 
     auto front() -> reference { return *m_begin; }
     auto front() const -> const_reference { return *m_begin; }
@@ -455,6 +610,18 @@ public:
     auto rend() const -> const_reverse_iterator { return const_reverse_iterator {m_begin}; }
     auto crend() const -> const_reverse_iterator { return const_reverse_iterator {m_begin}; }
 
+    // Contiguous blocks of elements, cheaper to loop over than iterators which check for the end of a subarray on
+    // every step
+    auto segments() -> DequeSegments<T, SUBARRAY_SIZE>
+    {
+        return {m_begin.m_subarray, m_end.m_subarray, m_begin.m_current, m_end.m_current};
+    }
+
+    auto segments() const -> DequeSegments<const T, SUBARRAY_SIZE>
+    {
+        return {m_begin.m_subarray, m_end.m_subarray, m_begin.m_current, m_end.m_current};
+    }
+
     ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
     // Capacity
     bool empty() const
@@ -467,9 +634,54 @@ public:
         return m_end - m_begin;
     }
 
+    // Free every subarray which holds no element, spare ones included, and shrink the pointer array to the subarrays
+    // in use plus one unused pointer at each end. Invalidates iterators, like any reallocation of the pointer array
     void shrink_to_fit()
     {
-        // TODO this method has no effect for now
+        free_subarrays(m_spare.data(), m_spare.data() + m_num_spare);
+        m_num_spare = 0;
+
+        if (ptr_array_size() == 0) {
+            return;
+        }
+
+        free_subarrays(m_ptr_array.data(), m_begin.m_subarray);
+        free_subarrays(m_end.m_subarray + 1, m_ptr_array.data() + ptr_array_size());
+
+        const auto num_used_ptr = std::distance(m_begin.m_subarray, m_end.m_subarray + 1);
+        const auto new_ptr_array_size = std::max(MIN_PTR_ARRAY_SIZE, num_used_ptr + 2);
+        if (new_ptr_array_size >= ptr_array_size()) {
+            return;
+        }
+
+        // Every unused pointer is null now, rotating the used ones into the middle only swaps them with nulls
+        const auto new_begin = m_ptr_array.data() + (new_ptr_array_size - num_used_ptr) / 2;
+        if (new_begin < m_begin.m_subarray) {
+            std::rotate(new_begin, m_begin.m_subarray, m_end.m_subarray + 1);
+        } else {
+            std::rotate(m_begin.m_subarray, m_end.m_subarray + 1, new_begin + num_used_ptr);
+        }
+        m_begin.set_subarray(new_begin);
+        m_end.set_subarray(new_begin + num_used_ptr - 1);
+
+        resize_ptr_array(new_ptr_array_size);
+    }
+
+    size_type spare_limit() const
+    {
+        return m_spare_limit;
+    }
+
+    // Keep up to n emptied subarrays for reuse, so a Deque used as a queue stops allocating once it reaches its
+    // steady size. n is capped at MAX_SPARE_SUBARRAYS, 0 frees emptied subarrays right away
+    void set_spare_limit(size_type n)
+    {
+        ASSERT(n >= 0);
+        m_spare_limit = std::min(n, MAX_SPARE_SUBARRAYS);
+        if (m_num_spare > m_spare_limit) {
+            free_subarrays(m_spare.data() + m_spare_limit, m_spare.data() + m_num_spare);
+            m_num_spare = m_spare_limit;
+        }
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -478,9 +690,7 @@ public:
     {
         destruct(m_begin, m_end);
         if (m_begin.m_subarray != m_end.m_subarray) {
-            for (auto& subarray : make_view(m_begin.m_subarray + 1, m_end.m_subarray)) {
-                subarray.reset();
-            }
+            release_subarrays(m_begin.m_subarray + 1, m_end.m_subarray);
         }
 
         m_end = m_begin;
@@ -498,6 +708,11 @@ public:
 
     iterator insert(const_iterator pos, size_type n, const value_type& v)
     {
+        if (n == 0) {
+            // Nothing to shift, moving the elements onto themselves would leave them moved-from
+            return pos.from_const();
+        }
+
         if (pos.m_current == m_begin.m_current) {
             // Insert at beginning
             const auto new_begin = realloc_subarray(n, Side::FRONT);
@@ -508,6 +723,12 @@ public:
             const auto new_end = realloc_subarray(n, Side::BACK);
             std::uninitialized_fill(m_end, new_end, v);
             m_end = new_end;
+        } else if (is_trivially_relocatable<T>::value) {
+            // Insert in the middle, v may be an element that is about to be shifted
+            const auto value = v;
+            return insert_relocate(pos - m_begin, n, [&](iterator gap) {
+                std::uninitialized_fill(gap, gap + n, value);
+            });
         } else {
             // Insert in the middle
             const auto dist = pos - m_begin;
@@ -576,16 +797,24 @@ public:
     {
         const auto n = std::distance(first, last);
 
+        if (n == 0) {
+            return pos.from_const();
+        }
+
         if (pos.m_current == m_begin.m_current) {
             // Insert at beginning
-            const auto new_begin = realloc_subarray(n, Side::FRONT);
-            std::uninitialized_copy(first, last, new_begin);
-            m_begin = new_begin;
+            prepend_n(first, n);
+            return m_begin;
         } else if (pos.m_current == m_end.m_current) {
             // Insert at end
-            const auto new_end = realloc_subarray(n, Side::BACK);
-            std::uninitialized_copy(first, last, m_end);
-            m_end = new_end;
+            const auto old_size = size();
+            append_n(first, n);
+            return m_begin + old_size;
+        } else if (is_trivially_relocatable<T>::value) {
+            // Insert in the middle, [first, last) must not be in this Deque
+            return insert_relocate(pos - m_begin, n, [&](iterator gap) {
+                construct_n(gap, first, n, is_memcpy_source<ForwardIter> {});
+            });
         } else {
             // Insert in the middle
             const auto dist = pos - m_begin;
@@ -627,7 +856,7 @@ public:
                     std::copy_backward(iter_pos, iter_copy_end, m_end);
                     std::copy(first, last, iter_pos);
                 } else {
-                    auto mid = first + dist_back;
+                    auto mid = std::next(first, dist_back);
 
                     const auto unin_mid = std::uninitialized_copy(mid, last, m_end);
                     std::uninitialized_copy(iter_pos, m_end, unin_mid);
@@ -661,6 +890,12 @@ public:
         value_type value {std::forward<Args>(args)...};
         auto iter_pos = pos.from_const();
         const auto dist = iter_pos - m_begin;
+        if (is_trivially_relocatable<T>::value) {
+            return insert_relocate(dist, 1, [&](iterator gap) {
+                construct(gap.m_current, std::move(value));
+            });
+        }
+
         if (dist < size() / 2) {
             // Insert in front half, shift front elements to the left
             emplace_front(*m_begin);
@@ -688,6 +923,10 @@ public:
 
     iterator erase(const_iterator pos)
     {
+        if (is_trivially_relocatable<T>::value) {
+            return erase_relocate(pos.from_const(), pos.from_const() + 1);
+        }
+
         auto iter_pos = pos.from_const();
         auto iter_next = iter_pos + 1;
         const auto dist = iter_pos - m_begin;
@@ -710,11 +949,19 @@ public:
         auto iter_first = first.from_const();
         auto iter_last = last.from_const();
 
+        if (iter_first == iter_last) {
+            return iter_first;
+        }
+
+        if (is_trivially_relocatable<T>::value && (iter_first != m_begin || iter_last != m_end)) {
+            return erase_relocate(iter_first, iter_last);
+        }
+
         if (iter_first != m_begin || iter_last != m_end) {
             const auto n = iter_last - iter_first;
             const auto dist = iter_first - m_begin;
 
-            if (dist < (size() - n) / 2) {
+            if (dist < size() - dist - n) {
                 // Erase in first half, shift front elements to the right
                 iter_last.copy_backward(m_begin, iter_first);
 
@@ -725,7 +972,7 @@ public:
                     destroy(m_begin.m_current);
                     ++m_begin;
                 }
-                free_subarrays(subarray_beg, iter_new_beg.m_subarray);
+                release_subarrays(subarray_beg, iter_new_beg.m_subarray);
             } else {
                 // Erase in second half, shift back elements to the left
                 iter_first.copy(iter_last, m_end);
@@ -735,7 +982,7 @@ public:
                 for (auto it = iter_new_end; it != m_end; ++it) {
                     destroy(it.m_current);
                 }
-                free_subarrays(iter_new_end.m_subarray + 1, m_end.m_subarray + 1);
+                release_subarrays(iter_new_end.m_subarray + 1, m_end.m_subarray + 1);
                 m_end = iter_new_end;
             }
 
@@ -772,7 +1019,7 @@ public:
                 realloc_ptr_array(1, Side::BACK);
             }
 
-            *std::next(m_end.m_subarray) = make_subarray();
+            make_subarrays(std::next(m_end.m_subarray), 1);
 
             construct(m_end.m_current, std::move(tmp));
             m_end.set_subarray(std::next(m_end.m_subarray));
@@ -785,7 +1032,8 @@ public:
         if (m_end.m_current != m_end.sub_begin()) {
             destroy(--m_end.m_current);
         } else {
-            (m_end.m_subarray--)->reset();
+            release_subarrays(m_end.m_subarray, m_end.m_subarray + 1);
+            --m_end.m_subarray;
             m_end.m_current = std::prev(m_end.sub_end());
             destroy(m_end.m_current);
         }
@@ -817,7 +1065,7 @@ public:
                 realloc_ptr_array(1, Side::FRONT);
             }
 
-            *std::prev(m_begin.m_subarray) = make_subarray();
+            make_subarrays(std::prev(m_begin.m_subarray), 1);
 
             m_begin.set_subarray(std::prev(m_begin.m_subarray));
             m_begin.m_current = std::prev(m_begin.sub_end());
@@ -831,11 +1079,38 @@ public:
             destroy(m_begin.m_current++);
         } else {
             destroy(m_begin.m_current);
-            (m_begin.m_subarray++)->reset();
+            release_subarrays(m_begin.m_subarray, m_begin.m_subarray + 1);
+            ++m_begin.m_subarray;
             m_begin.m_current = m_begin.sub_begin();
         }
     }
 
+    // Copy [first, last) to the back. All subarrays needed are reserved first, then the elements are copied one
+    // subarray at a time, with memcpy for trivially copyable elements from contiguous memory. [first, last) must not
+    // be in this Deque, except as a span
+    template <typename ForwardIter, typename = std::enable_if_t<is_forward_iterator<ForwardIter>::value>>
+    void append(ForwardIter first, ForwardIter last)
+    {
+        append_n(first, std::distance(first, last));
+    }
+
+    void append(gsl::span<const value_type> values)
+    {
+        append_n(values.data(), values.size());
+    }
+
+    // Copy [first, last) to the front, keeping its order
+    template <typename ForwardIter, typename = std::enable_if_t<is_forward_iterator<ForwardIter>::value>>
+    void prepend(ForwardIter first, ForwardIter last)
+    {
+        prepend_n(first, std::distance(first, last));
+    }
+
+    void prepend(gsl::span<const value_type> values)
+    {
+        prepend_n(values.data(), values.size());
+    }
+
     void resize(size_type n)
     {
         resize(n, value_type {});
@@ -853,21 +1128,388 @@ public:
 
     void swap(this_type& rhs) noexcept
     {
-        std::swap(m_ptr_array, rhs.m_ptr_array);
+        m_ptr_array.swap(rhs.m_ptr_array);
         std::swap(m_begin, rhs.m_begin);
         std::swap(m_end, rhs.m_end);
     }
 
+    // Move the elements of rhs to the back, rhs is left empty. If rhs begins at the same offset in its first subarray
+    // as this Deque ends in its last one, the subarrays of rhs are handed over and only the elements of the boundary
+    // subarray are moved, the smaller half of it, so the cost is one pointer per subarray. Otherwise the elements of
+    // the shorter Deque are moved one by one, O(min(size(), rhs.size())), which is the usual case for Deques filled
+    // independently. Subarrays are never handed over with a gap, element addresses are computed from the offset of
+    // begin() and rely on every subarray but the first and last one being full.
+    // Both Deques must allocate from the same allocator.
+    void splice_back(this_type&& rhs)
+    {
+        if (rhs.empty()) {
+            return;
+        }
+
+        if (empty()) {
+            swap(rhs);
+            return;
+        }
+
+        const auto offset = m_end.m_current - m_end.sub_begin();
+        if (offset != rhs.m_begin.m_current - rhs.m_begin.sub_begin()) {
+            if (size() >= rhs.size()) {
+                for (auto segment : rhs.segments()) {
+                    append(std::make_move_iterator(segment.data()),
+                           std::make_move_iterator(segment.data() + segment.size()));
+                }
+                rhs.clear();
+            } else {
+                rhs.prepend(std::make_move_iterator(m_begin), std::make_move_iterator(m_end));
+                clear();
+                swap(rhs);
+            }
+            return;
+        }
+
+        // Make room for the subarrays after the first one of rhs
+        const auto num_moved = rhs.m_end.m_subarray - rhs.m_begin.m_subarray;
+        const auto num_ptrs_avail = ((m_ptr_array.data() + ptr_array_size()) - m_end.m_subarray) - 1;
+        if (num_moved > num_ptrs_avail) {
+            realloc_ptr_array(num_moved - num_ptrs_avail, Side::BACK);
+        }
+
+        // Our last subarray and the first one of rhs become one, keep the one holding more elements
+        const auto last_begin = m_begin.m_subarray == m_end.m_subarray ? m_begin.m_current : m_end.sub_begin();
+        const auto first_end = num_moved == 0 ? rhs.m_end.m_current : rhs.m_begin.sub_end();
+        const auto num_last = m_end.m_current - last_begin;
+        const auto num_first = first_end - rhs.m_begin.m_current;
+        const auto end_offset = rhs.m_end.m_current - rhs.m_end.sub_begin();
+        if (num_first <= num_last) {
+            relocate_elements(rhs.m_begin.m_current, num_first, m_end.m_current);
+        } else {
+            const auto dest = rhs.m_begin.sub_begin() + (last_begin - m_end.sub_begin());
+            relocate_elements(last_begin, num_last, dest);
+            std::swap(*m_end.m_subarray, *rhs.m_begin.m_subarray);
+            if (m_begin.m_subarray == m_end.m_subarray) {
+                m_begin.m_current = dest;
+            }
+        }
+
+        for (size_type i = 1; i <= num_moved; ++i) {
+            release_subarrays(m_end.m_subarray + i, m_end.m_subarray + i + 1);
+            std::swap(m_end.m_subarray[i], rhs.m_begin.m_subarray[i]);
+        }
+
+        m_end.set_subarray(m_end.m_subarray + num_moved);
+        m_end.m_current = m_end.sub_begin() + end_offset;
+
+        rhs.m_begin.m_current = rhs.m_begin.sub_begin() + offset;
+        rhs.m_end = rhs.m_begin;
+    }
+
+    // Move the elements of rhs to the front, rhs is left empty. Subarrays are handed over as with splice_back
+    void splice_front(this_type&& rhs)
+    {
+        rhs.splice_back(std::move(*this));
+        swap(rhs);
+    }
+
 protected:
-    SubarrayPtr make_subarray()
+    // Move the elements from n on to tail, which must be empty. The subarrays after the one holding the n-th element
+    // are handed over, the elements of that subarray which are fewer, on either side of n, are moved to a new one
+    void split_to(size_type n, this_type& tail)
+    {
+        ASSERT(n >= 0 && n <= size() && tail.empty());
+        if (n == size()) {
+            return;
+        }
+
+        if (n == 0) {
+            swap(tail);
+            return;
+        }
+
+        auto pos = m_begin + n;
+        const auto num_subarrays = (m_end.m_subarray - pos.m_subarray) + 1;
+        tail.resize_ptr_array(std::max(MIN_PTR_ARRAY_SIZE, num_subarrays + 2));
+
+        // The subarray tail holds now, it takes the elements on one side of n
+        auto& new_subarray = *tail.m_begin.m_subarray;
+
+        const auto subarray = pos.sub_begin();
+        const auto pos_offset = pos.m_current - subarray;
+        const auto end_offset = m_end.m_current - m_end.sub_begin();
+        const auto first = pos.m_subarray == m_begin.m_subarray ? m_begin.m_current : subarray;
+        const auto last = pos.m_subarray == m_end.m_subarray ? m_end.m_current : pos.sub_end();
+        if (last - pos.m_current <= pos.m_current - first) {
+            relocate_elements(pos.m_current, last - pos.m_current, new_subarray + pos_offset);
+        } else {
+            relocate_elements(first, pos.m_current - first, new_subarray + (first - subarray));
+            std::swap(*pos.m_subarray, new_subarray);
+            if (pos.m_subarray == m_begin.m_subarray) {
+                m_begin.m_current = pos.sub_begin() + (first - subarray);
+            }
+        }
+
+        // Leave a free pointer at the front of tail, like init() does
+        auto tail_subarrays = tail.m_ptr_array.data() + 1;
+        std::swap(tail_subarrays[0], new_subarray);
+        for (size_type i = 1; i < num_subarrays; ++i) {
+            std::swap(tail_subarrays[i], pos.m_subarray[i]);
+        }
+
+        tail.m_begin.set_subarray(tail_subarrays);
+        tail.m_begin.m_current = tail.m_begin.sub_begin() + pos_offset;
+        tail.m_end.set_subarray(tail_subarrays + num_subarrays - 1);
+        tail.m_end.m_current = tail.m_end.sub_begin() + end_offset;
+
+        m_end.set_subarray(pos.m_subarray);
+        m_end.m_current = m_end.sub_begin() + pos_offset;
+    }
+
+    template <typename Iter>
+    using is_memcpy_source = std::integral_constant<bool,
+        std::is_trivially_copyable<T>::value && std::is_pointer<Iter>::value &&
+        std::is_same<std::remove_cv_t<std::remove_pointer_t<Iter>>, T>::value>;
+
+    // Construct count elements at dest from first, return the iterator past the last element copied
+    template <typename Iter>
+    static Iter copy_chunk(Iter first, size_type count, T* dest, std::false_type)
+    {
+        auto last = std::next(first, count);
+        std::uninitialized_copy(first, last, dest);
+        return last;
+    }
+
+    template <typename Iter>
+    static Iter copy_chunk(Iter first, size_type count, T* dest, std::true_type)
+    {
+        std::memcpy(dest, first, static_cast<size_t>(count) * sizeof(T));
+        return first + count;
+    }
+
+    // Construct n elements from first at dest, one subarray at a time for a memcpy source
+    template <typename Iter>
+    static void construct_n(iterator dest, Iter first, size_type n, std::false_type)
+    {
+        std::uninitialized_copy(first, std::next(first, n), dest);
+    }
+
+    template <typename Iter>
+    static void construct_n(iterator dest, Iter first, size_type n, std::true_type)
+    {
+        while (n > 0) {
+            const auto count = std::min(n, static_cast<size_type>(dest.sub_end() - dest.m_current));
+            first = copy_chunk(first, count, dest.m_current, std::true_type {});
+            dest += count;
+            n -= count;
+        }
+    }
+
+    // Move n elements from src to raw memory at dest, the elements left behind are raw memory
+    static void relocate_elements(T* src, size_type n, T* dest)
+    {
+        relocate_elements(src, n, dest, is_trivially_relocatable<T> {});
+    }
+
+    static void relocate_elements(T* src, size_type n, T* dest, std::true_type)
+    {
+        std::memcpy(static_cast<void*>(dest), static_cast<const void*>(src), static_cast<size_t>(n) * sizeof(T));
+    }
+
+    static void relocate_elements(T* src, size_type n, T* dest, std::false_type)
+    {
+        std::uninitialized_copy(std::make_move_iterator(src), std::make_move_iterator(src + n), dest);
+        std::for_each(src, src + n, [](T& value) { destroy(&value); });
+    }
+
+    // Move the elements in [first, last) to dest with memmove, one run of contiguous elements at a time. The ranges
+    // may overlap, the elements left behind are raw memory
+    static void relocate(iterator first, iterator last, iterator dest)
+    {
+        auto n = last - first;
+        if (n == 0 || first == dest) {
+            return;
+        }
+
+        if (dest < first) {
+            while (n > 0) {
+                const auto count = std::min({n, static_cast<size_type>(first.sub_end() - first.m_current),
+                                             static_cast<size_type>(dest.sub_end() - dest.m_current)});
+                std::memmove(static_cast<void*>(dest.m_current), static_cast<const void*>(first.m_current),
+                             static_cast<size_t>(count) * sizeof(T));
+                first += count;
+                dest += count;
+                n -= count;
+            }
+        } else {
+            auto dest_last = dest + n;
+            while (n > 0) {
+                // Elements right before an iterator at the start of a subarray end the previous subarray
+                const auto src_count = last.m_current == last.sub_begin() ?
+                    SUBARRAY_SIZE : last.m_current - last.sub_begin();
+                const auto dest_count = dest_last.m_current == dest_last.sub_begin() ?
+                    SUBARRAY_SIZE : dest_last.m_current - dest_last.sub_begin();
+                const auto count = std::min({n, src_count, dest_count});
+                last -= count;
+                dest_last -= count;
+                std::memmove(static_cast<void*>(dest_last.m_current), static_cast<const void*>(last.m_current),
+                             static_cast<size_t>(count) * sizeof(T));
+                n -= count;
+            }
+        }
+    }
+
+    // Open a gap of n elements at dist by relocating the shorter side, construct_gap(gap) fills it. The elements are
+    // moved back if it throws
+    template <typename ConstructGap>
+    iterator insert_relocate(size_type dist, size_type n, ConstructGap construct_gap)
+    {
+        if (n == 0) {
+            return m_begin + dist;
+        }
+
+        if (dist <= size() / 2) {
+            auto new_begin = realloc_subarray(n, Side::FRONT);
+            auto gap = new_begin + dist;
+            relocate(m_begin, m_begin + dist, new_begin);
+            try {
+                construct_gap(gap);
+            } catch (...) {
+                relocate(new_begin, gap, m_begin);
+                throw;
+            }
+
+            m_begin = new_begin;
+            return gap;
+        } else {
+            auto new_end = realloc_subarray(n, Side::BACK);
+            auto gap = m_begin + dist;
+            relocate(gap, m_end, gap + n);
+            try {
+                construct_gap(gap);
+            } catch (...) {
+                relocate(gap + n, new_end, gap);
+                throw;
+            }
+
+            m_end = new_end;
+            return gap;
+        }
+    }
+
+    // Destroy [first, last) and close the gap by relocating the shorter side
+    iterator erase_relocate(iterator first, iterator last)
+    {
+        const auto dist = first - m_begin;
+        const auto n = last - first;
+        destruct(first, last);
+        if (dist < size() - dist - n) {
+            auto new_begin = m_begin + n;
+            relocate(m_begin, first, new_begin);
+            release_subarrays(m_begin.m_subarray, new_begin.m_subarray);
+            m_begin = new_begin;
+        } else {
+            auto new_end = m_end - n;
+            relocate(last, m_end, first);
+            release_subarrays(new_end.m_subarray + 1, m_end.m_subarray + 1);
+            m_end = new_end;
+        }
+
+        return m_begin + dist;
+    }
+
+    template <typename Iter>
+    void append_n(Iter first, size_type n)
+    {
+        realloc_subarray(n, Side::BACK);
+
+        // m_end moves after each subarray, so elements already copied are owned if a copy throws
+        while (n > 0) {
+            const auto count = std::min(n, static_cast<size_type>(m_end.sub_end() - m_end.m_current));
+            first = copy_chunk(first, count, m_end.m_current, is_memcpy_source<Iter> {});
+            m_end += count;
+            n -= count;
+        }
+    }
+
+    template <typename Iter>
+    void prepend_n(Iter first, size_type n)
+    {
+        const auto new_begin = realloc_subarray(n, Side::FRONT);
+
+        auto dest = new_begin;
+        try {
+            while (dest != m_begin) {
+                const auto count = std::min(m_begin - dest, static_cast<size_type>(dest.sub_end() - dest.m_current));
+                first = copy_chunk(first, count, dest.m_current, is_memcpy_source<Iter> {});
+                dest += count;
+            }
+        } catch (...) {
+            destruct(new_begin, dest);
+            throw;
+        }
+
+        m_begin = new_begin;
+    }
+
+    static_assert((SUBARRAY_SIZE & (SUBARRAY_SIZE - 1)) == 0, "Subarray size is not power of 2");
+    static constexpr size_type SUBARRAY_SHIFT = subarray_shift(SUBARRAY_SIZE);
+
+    // Address of the n-th element, found with a shift and a mask instead of going through iterator arithmetic
+    T* element_at(size_type n) const
     {
-        return std::make_unique<Subarray>();
+        const auto pos = (m_begin.m_current - m_begin.sub_begin()) + n;
+        return m_begin.m_subarray[pos >> SUBARRAY_SHIFT] + (pos & (SUBARRAY_SIZE - 1));
+    }
+
+    // Give every empty pointer in [first, first + count) a subarray, spare subarrays first and then new ones
+    // allocated in bulk. A pointer outside the used range may still hold a subarray, which is reused as it is
+    void make_subarrays(SubarrayPtr* first, size_type count)
+    {
+        const auto last = first + count;
+        auto num_empty = std::count(first, last, nullptr);
+
+        for (; num_empty > 0 && m_num_spare > 0; --num_empty) {
+            first = std::find(first, last, nullptr);
+            *first = m_spare[--m_num_spare];
+        }
+
+        Alloc alloc;
+        std::array<void*, SUBARRAY_BULK_SIZE> blocks;
+        while (num_empty > 0) {
+            const auto batch = std::min(num_empty, SUBARRAY_BULK_SIZE);
+            const auto num_blocks = alloc_memory_bulk(alloc, batch, Subarray::BLOCK_SIZE, align_of<T>, blocks.data());
+            if (num_blocks < batch) {
+                dealloc_memory_bulk(alloc, num_blocks, Subarray::BLOCK_SIZE, blocks.data());
+                throw std::bad_alloc {};
+            }
+
+            for (size_type i = 0; i < batch; ++i) {
+                first = std::find(first, last, nullptr);
+                *first = static_cast<T*>(blocks[i]);
+            }
+
+            num_empty -= batch;
+        }
+    }
+
+    // Move subarrays no longer in use to the spares, and free them once there are enough spares
+    void release_subarrays(SubarrayPtr* first, SubarrayPtr* last)
+    {
+        for (auto& subarray : make_view(first, last)) {
+            if (subarray != nullptr && m_num_spare < m_spare_limit) {
+                m_spare[m_num_spare++] = subarray;
+                subarray = nullptr;
+            }
+        }
+
+        free_subarrays(first, last);
     }
 
     void free_subarrays(SubarrayPtr* first, SubarrayPtr* last)
     {
-        while (first != last) {
-            (first++)->reset();
+        for (auto& subarray : make_view(first, last)) {
+            if (subarray != nullptr) {
+                Subarray::deallocate(subarray);
+                subarray = nullptr;
+            }
         }
     }
 
@@ -878,7 +1520,6 @@ protected:
         auto dist_end = m_end.m_subarray - m_ptr_array.data();
 
         m_ptr_array.resize(n);
-        m_ptr_array.shrink_to_fit();
 
         m_begin.set_subarray(m_ptr_array.data() + dist_beg);
         m_end.set_subarray(m_ptr_array.data() + dist_end);
@@ -891,21 +1532,22 @@ protected:
         const auto num_unused_ptr_back   = (ptr_array_size() - num_unused_ptr_front) - num_used_ptr;
         SubarrayPtr* new_ptr_array_begin = nullptr;
 
-        // If we have enough unused pointers, we could just move them around (Use memmove to take care of overlap)
+        // If we have enough unused pointers, we could just move them around. Rotate rather than move, so subarrays
+        // kept in the unused pointers are swapped to the other side instead of being overwritten
         if (side == Side::BACK && ptr_count <= num_unused_ptr_front) {
             // If there's a lot of unused pointers at front, move at least half of them
             ptr_count = std::max(ptr_count, num_unused_ptr_front / 2);
 
             // Move pointers to the left
             new_ptr_array_begin = std::prev(m_begin.m_subarray, ptr_count);
-            std::move(m_begin.m_subarray, m_end.m_subarray + 1, new_ptr_array_begin);
+            std::rotate(new_ptr_array_begin, m_begin.m_subarray, m_end.m_subarray + 1);
         } else if (side == Side::FRONT && ptr_count <= num_unused_ptr_back) {
             // If there's a lot of unused pointers at back, move at least half of them
             ptr_count = std::max(ptr_count, num_unused_ptr_back / 2);
 
             // Move pointers to the right
             new_ptr_array_begin = std::next(m_begin.m_subarray, ptr_count);
-            std::move_backward(m_begin.m_subarray, m_end.m_subarray + 1, std::next(new_ptr_array_begin, num_used_ptr));
+            std::rotate(m_begin.m_subarray, m_end.m_subarray + 1, std::next(new_ptr_array_begin, num_used_ptr));
         } else {
             // If we really need more subarrays, double the ptr_array capacity or allocate more if needed
             const auto old_ptr_array_size = ptr_array_size();
@@ -914,7 +1556,7 @@ protected:
 
             new_ptr_array_begin = std::next(m_ptr_array.data(), num_unused_ptr_front +
                 (side == Side::FRONT ? ptr_count : 0));
-            std::move_backward(m_begin.m_subarray, m_end.m_subarray + 1, std::next(new_ptr_array_begin, num_used_ptr));
+            std::rotate(m_begin.m_subarray, m_end.m_subarray + 1, std::next(new_ptr_array_begin, num_used_ptr));
         }
 
         // Reset the begin and end iterators
@@ -937,9 +1579,7 @@ protected:
                     realloc_ptr_array(num_subarray_needed - num_subarray_avail, Side::FRONT);
                 }
 
-                for(size_type i = 1; i <= num_subarray_needed; ++i) {
-                    m_begin.m_subarray[-i] = make_subarray();
-                }
+                make_subarrays(m_begin.m_subarray - num_subarray_needed, num_subarray_needed);
             }
 
             return m_begin - capacity;
@@ -954,9 +1594,7 @@ protected:
                     realloc_ptr_array(num_subarray_needed - num_ptrs_avail, Side::BACK);
                 }
 
-                for(size_type i = 1; i <= num_subarray_needed; ++i) {
-                    m_end.m_subarray[i] = make_subarray();
-                }
+                make_subarrays(m_end.m_subarray + 1, num_subarray_needed);
             }
 
             return m_end + capacity;
@@ -979,10 +1617,8 @@ protected:
         resize_ptr_array(reserve_ptr_array_size);
 
         auto offset = (reserve_ptr_array_size - new_ptr_array_size) / 2;
-        auto ptr_array_view = make_view(m_ptr_array, offset, new_ptr_array_size);
-        for (auto& subarray : ptr_array_view) {
-            subarray = make_subarray();
-        }
+        auto ptr_array_view = make_view(m_ptr_array.data() + offset, m_ptr_array.data() + offset + new_ptr_array_size);
+        make_subarrays(ptr_array_view.data(), new_ptr_array_size);
 
         m_begin.set_subarray(ptr_array_view.data());
         m_begin.m_current = m_begin.sub_begin();
@@ -994,7 +1630,7 @@ protected:
     void init_with_value(const value_type& value)
     {
         for (auto& subarray : make_view(m_begin.m_subarray, m_end.m_subarray)) {
-            std::uninitialized_fill(subarray->begin(), subarray->end(), value);
+            std::uninitialized_fill(subarray, subarray + SUBARRAY_SIZE, value);
         }
         std::uninitialized_fill(m_end.sub_begin(), m_end.m_current, value);
     }
@@ -1019,14 +1655,8 @@ protected:
     template <typename ForwardIterator>
     void init_with_iterator(ForwardIterator first, ForwardIterator last, std::forward_iterator_tag)
     {
-        init(std::distance(first, last));
-        for (auto& subarray : make_view(m_begin.m_subarray, m_end.m_subarray)) {
-            auto next = std::next(first, SUBARRAY_SIZE);
-            std::uninitialized_copy(first, next, subarray->begin());
-            first = next;
-        }
-
-        std::uninitialized_copy(first, last, m_end.sub_begin());
+        init(0);
+        append(first, last);
     }
 
     size_type ptr_array_size() const
@@ -1036,20 +1666,29 @@ protected:
 
 protected:
     // Array of pointers to Subarrays
-    std::vector<SubarrayPtr, STLAllocator<SubarrayPtr>> m_ptr_array {};
+    PtrArrayT<SubarrayPtr, Alloc> m_ptr_array {};
     iterator m_begin {};
     iterator m_end {};
+
+    // Emptied subarrays kept for reuse at either end
+    std::array<SubarrayPtr, MAX_SPARE_SUBARRAYS> m_spare {};
+    size_type m_num_spare = 0;
+    size_type m_spare_limit = DEFAULT_SPARE_SUBARRAYS;
 };
 
 }   // namespace detail
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Deque
-template <typename T, size_type SUBARRAY_SIZE = detail::DEFAULT_SUBARRAY_SIZE<T>>
-class Deque : public detail::DequeImpl<T, SUBARRAY_SIZE> {
+// Alloc is an allocation policy, ActiveAllocatorPolicy uses whatever allocator is active when a subarray is allocated
+// or freed, StaticAllocatorPolicy<AllocT> binds the container to a concrete allocator type at compile time.
+template <typename T,
+          size_type SUBARRAY_SIZE = detail::DEFAULT_SUBARRAY_SIZE<T>,
+          typename Alloc = ActiveAllocatorPolicy>
+class Deque : public detail::DequeImpl<T, SUBARRAY_SIZE, Alloc> {
 public:
-    using this_type = Deque<T, SUBARRAY_SIZE>;
-    using base_type = detail::DequeImpl<T, SUBARRAY_SIZE>;
+    using this_type = Deque<T, SUBARRAY_SIZE, Alloc>;
+    using base_type = detail::DequeImpl<T, SUBARRAY_SIZE, Alloc>;
     using typename base_type::value_type;
     using typename base_type::pointer;
     using typename base_type::const_pointer;
@@ -1114,12 +1753,21 @@ public:
 
         return *this;
     }
+
+    // Keep the first n elements, return the rest in a new Deque
+    this_type split_at(size_type n)
+    {
+        this_type tail;
+        this->split_to(n, tail);
+
+        return tail;
+    }
 };
 CLS_END
 
 namespace std {
-template <typename T, cls::size_type SUBARRAY_SIZE>
-void swap(cls::Deque<T, SUBARRAY_SIZE>& lhs, cls::Deque<T, SUBARRAY_SIZE>& rhs) noexcept
+template <typename T, cls::size_type SUBARRAY_SIZE, typename Alloc>
+void swap(cls::Deque<T, SUBARRAY_SIZE, Alloc>& lhs, cls::Deque<T, SUBARRAY_SIZE, Alloc>& rhs) noexcept
 {
     lhs.swap(rhs);
 }
@@ -0,0 +1,281 @@
+/////////////////////////////////////////////////////////////////////////////////
+// The MIT License(MIT)
+//
+// Copyright (c) 2016 Tiangang Song
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+/////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <iterator>
+#include "allocator.h"
+
+CLS_BEGIN
+namespace detail {
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// RingIterator
+// Position in a ring of N elements, counted from the start of the storage without wrapping, so that positions compare
+// and subtract like plain indices
+template <typename T, typename Pointer, typename Reference, size_type N>
+struct RingIterator {
+    using this_type         = RingIterator<T, Pointer, Reference, N>;
+    using const_iterator    = RingIterator<T, const T*, const T&, N>;
+    using difference_type   = std::ptrdiff_t;
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type        = T;
+    using pointer           = Pointer;
+    using reference         = Reference;
+
+    RingIterator() = default;
+    RingIterator(Pointer data, size_type pos) : m_data {data}, m_pos {pos} {}
+
+    // Support construct/assign const_iterator from iterator
+    operator const_iterator() const
+    {
+        return const_iterator {m_data, m_pos};
+    }
+
+    auto operator->() const -> pointer { return m_data + (m_pos & (N - 1)); }
+    auto operator*() const -> reference { return m_data[m_pos & (N - 1)]; }
+    auto operator[](difference_type n) const -> reference { return m_data[(m_pos + n) & (N - 1)]; }
+
+    this_type& operator++() { ++m_pos; return *this; }
+    this_type& operator--() { --m_pos; return *this; }
+    this_type operator++(int) { auto tmp = *this; ++m_pos; return tmp; }
+    this_type operator--(int) { auto tmp = *this; --m_pos; return tmp; }
+
+    this_type& operator+=(difference_type n) { m_pos += n; return *this; }
+    this_type& operator-=(difference_type n) { m_pos -= n; return *this; }
+    this_type operator+(difference_type n) const { return {m_data, m_pos + n}; }
+    this_type operator-(difference_type n) const { return {m_data, m_pos - n}; }
+
+    template <typename PointerU, typename ReferenceU>
+    difference_type operator-(const RingIterator<T, PointerU, ReferenceU, N>& x) const { return m_pos - x.m_pos; }
+
+    template <typename PointerU, typename ReferenceU>
+    bool operator==(const RingIterator<T, PointerU, ReferenceU, N>& rhs) const { return m_pos == rhs.m_pos; }
+
+    template <typename PointerU, typename ReferenceU>
+    bool operator!=(const RingIterator<T, PointerU, ReferenceU, N>& rhs) const { return m_pos != rhs.m_pos; }
+
+    template <typename PointerU, typename ReferenceU>
+    bool operator<(const RingIterator<T, PointerU, ReferenceU, N>& rhs) const { return m_pos < rhs.m_pos; }
+
+    template <typename PointerU, typename ReferenceU>
+    bool operator>(const RingIterator<T, PointerU, ReferenceU, N>& rhs) const { return m_pos > rhs.m_pos; }
+
+    template <typename PointerU, typename ReferenceU>
+    bool operator<=(const RingIterator<T, PointerU, ReferenceU, N>& rhs) const { return m_pos <= rhs.m_pos; }
+
+    template <typename PointerU, typename ReferenceU>
+    bool operator>=(const RingIterator<T, PointerU, ReferenceU, N>& rhs) const { return m_pos >= rhs.m_pos; }
+
+    Pointer m_data = nullptr;
+    size_type m_pos = 0;
+};
+
+template <typename T, typename Pointer, typename Reference, size_type N>
+inline auto operator+(std::ptrdiff_t n, const RingIterator<T, Pointer, Reference, N>& x)
+{
+    return x + n;
+}
+}   // namespace detail
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// RingDeque
+// Fixed capacity of N elements, a power of 2, allocated once by the constructor. Once it is full, pushing at the back
+// overwrites the oldest element, which makes it a sliding window of the last N elements. The elements are at most two
+// contiguous spans, segments() returns them, empty spans included. The storage is cache line aligned.
+template <typename T, size_type N, typename Alloc = ActiveAllocatorPolicy>
+class RingDeque {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "RingDeque capacity is not power of 2");
+
+public:
+    using this_type              = RingDeque<T, N, Alloc>;
+    using value_type             = T;
+    using pointer                = T*;
+    using const_pointer          = const T*;
+    using reference              = T&;
+    using const_reference        = const T&;
+    using iterator               = detail::RingIterator<T, T*, T&, N>;
+    using const_iterator         = detail::RingIterator<T, const T*, const T&, N>;
+    using reverse_iterator       = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+    using difference_type        = std::ptrdiff_t;
+
+    static constexpr size_type ALIGNMENT = std::max(align_of<T>, CACHE_LINE_SIZE);
+
+    RingDeque() : m_data {allocate()} {}
+
+    RingDeque(const this_type& rhs) : RingDeque {}
+    {
+        std::for_each(rhs.begin(), rhs.end(), [this](const value_type& value) { emplace_back(value); });
+    }
+
+    RingDeque(this_type&& rhs) : RingDeque {}
+    {
+        swap(rhs);
+    }
+
+    ~RingDeque()
+    {
+        clear();
+        Alloc alloc;
+        dealloc_memory(alloc, m_data, size_of<T> * N);
+    }
+
+    this_type& operator=(const this_type& rhs)
+    {
+        if (&rhs != this) {
+            this_type tmp {rhs};
+            swap(tmp);
+        }
+
+        return *this;
+    }
+
+    this_type& operator=(this_type&& rhs) noexcept
+    {
+        if (&rhs != this) {
+            swap(rhs);
+        }
+
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    // Element access
+    reference operator[](size_type n) { return m_data[(m_begin + n) & (N - 1)]; }
+    const_reference operator[](size_type n) const { return m_data[(m_begin + n) & (N - 1)]; }
+
+    reference front() { return m_data[m_begin]; }
+    const_reference front() const { return m_data[m_begin]; }
+    reference back() { return (*this)[m_size - 1]; }
+    const_reference back() const { return (*this)[m_size - 1]; }
+
+    // The oldest elements up to the end of the storage, then the ones which wrapped around to its start
+    auto segments() -> std::array<gsl::span<T>, 2>
+    {
+        const auto first_size = std::min(m_size, N - m_begin);
+        return {{{m_data + m_begin, m_data + m_begin + first_size}, {m_data, m_data + m_size - first_size}}};
+    }
+
+    auto segments() const -> std::array<gsl::span<const T>, 2>
+    {
+        const auto first_size = std::min(m_size, N - m_begin);
+        return {{{m_data + m_begin, m_data + m_begin + first_size}, {m_data, m_data + m_size - first_size}}};
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    // Iterators
+    iterator begin() { return {m_data, m_begin}; }
+    const_iterator begin() const { return {m_data, m_begin}; }
+    const_iterator cbegin() const { return begin(); }
+    iterator end() { return {m_data, m_begin + m_size}; }
+    const_iterator end() const { return {m_data, m_begin + m_size}; }
+    const_iterator cend() const { return end(); }
+
+    reverse_iterator rbegin() { return reverse_iterator {end()}; }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator {end()}; }
+    reverse_iterator rend() { return reverse_iterator {begin()}; }
+    const_reverse_iterator rend() const { return const_reverse_iterator {begin()}; }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    // Capacity
+    bool empty() const { return m_size == 0; }
+    bool full() const { return m_size == N; }
+    size_type size() const { return m_size; }
+    static constexpr size_type capacity() { return N; }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+    void clear()
+    {
+        while (!empty()) {
+            pop_front();
+        }
+        m_begin = 0;
+    }
+
+    void push_back(const value_type& value) { emplace_back(value); }
+    void push_back(value_type&& value) { emplace_back(std::move(value)); }
+
+    // Overwrite the oldest element if the deque is full. It is destroyed first, so it is gone even if constructing
+    // the new element throws
+    template <typename... Args>
+    void emplace_back(Args&&... args)
+    {
+        if (full()) {
+            pop_front();
+        }
+
+        construct(m_data + ((m_begin + m_size) & (N - 1)), std::forward<Args>(args)...);
+        ++m_size;
+    }
+
+    void pop_front()
+    {
+        destroy(m_data + m_begin);
+        m_begin = (m_begin + 1) & (N - 1);
+        --m_size;
+    }
+
+    void pop_back()
+    {
+        destroy(&back());
+        --m_size;
+    }
+
+    void swap(this_type& rhs) noexcept
+    {
+        std::swap(m_data, rhs.m_data);
+        std::swap(m_begin, rhs.m_begin);
+        std::swap(m_size, rhs.m_size);
+    }
+
+private:
+    static T* allocate()
+    {
+        Alloc alloc;
+        auto p = static_cast<T*>(alloc_memory(alloc, size_of<T> * N, ALIGNMENT));
+        if (p == nullptr) {
+            throw std::bad_alloc {};
+        }
+
+        return p;
+    }
+
+    T* m_data;
+
+    // Storage index of the oldest element
+    size_type m_begin = 0;
+    size_type m_size = 0;
+};
+CLS_END
+
+namespace std {
+template <typename T, cls::size_type N, typename Alloc>
+void swap(cls::RingDeque<T, N, Alloc>& lhs, cls::RingDeque<T, N, Alloc>& rhs) noexcept
+{
+    lhs.swap(rhs);
+}
+}
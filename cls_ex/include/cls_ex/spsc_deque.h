@@ -0,0 +1,238 @@
+/////////////////////////////////////////////////////////////////////////////////
+// The MIT License(MIT)
+//
+// Copyright (c) 2016 Tiangang Song
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+/////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include "deque_x.h"
+
+CLS_BEGIN
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// SpscDeque
+// Unbounded queue for one producer thread and one consumer thread. Elements are stored in subarrays of SUBARRAY_SIZE
+// like in Deque, which are linked into a list instead of a pointer array. head and tail count the elements popped and
+// pushed so far, each sits on a cache line of its own. push and pop never wait for the other thread.
+// The consumer publishes the block it is reading, every block before it is reused by the producer for new elements,
+// so a queue which doesn't keep growing stops allocating. Blocks are only freed by the destructor, from the thread
+// which runs it, keep that in mind with ActiveAllocatorPolicy.
+template <typename T,
+          size_type SUBARRAY_SIZE = detail::DEFAULT_SUBARRAY_SIZE<T>,
+          typename Alloc = ActiveAllocatorPolicy>
+class SpscDeque {
+public:
+    using value_type = T;
+
+    SpscDeque()
+    {
+        auto block = make_block();
+        m_first = block;
+        m_tail_block = block;
+        m_head_block.store(block, std::memory_order_relaxed);
+    }
+
+    SpscDeque(const SpscDeque&) = delete;
+    SpscDeque& operator=(const SpscDeque&) = delete;
+
+    ~SpscDeque()
+    {
+        const auto tail = m_tail.load(std::memory_order_acquire);
+        for (auto head = m_head.load(std::memory_order_relaxed); head != tail; ++head) {
+            destroy(consumer_slot(head));
+        }
+
+        for (auto block = m_first; block != nullptr;) {
+            auto next = block->next.load(std::memory_order_relaxed);
+            free_block(block);
+            block = next;
+        }
+    }
+
+    // Producer
+    template <typename... Args>
+    void emplace(Args&&... args)
+    {
+        const auto tail = m_tail.load(std::memory_order_relaxed);
+        construct(producer_slot(tail), std::forward<Args>(args)...);
+        m_tail.store(tail + 1, std::memory_order_release);
+    }
+
+    void push(const value_type& value) { emplace(value); }
+    void push(value_type&& value) { emplace(std::move(value)); }
+
+    // Producer, push n elements from first. They are published to the consumer one subarray at a time
+    template <typename ForwardIter>
+    void push_n(ForwardIter first, size_type n)
+    {
+        auto tail = m_tail.load(std::memory_order_relaxed);
+        while (n > 0) {
+            auto slot = producer_slot(tail);
+            const auto count = std::min(n, m_tail_block_start + SUBARRAY_SIZE - tail);
+            auto last = std::next(first, count);
+            std::uninitialized_copy(first, last, slot);
+            first = last;
+            tail += count;
+            n -= count;
+            m_tail.store(tail, std::memory_order_release);
+        }
+    }
+
+    // Consumer, return false if the queue is empty
+    bool try_pop(value_type& value)
+    {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail_cache && head == (m_tail_cache = m_tail.load(std::memory_order_acquire))) {
+            return false;
+        }
+
+        auto slot = consumer_slot(head);
+        value = std::move(*slot);
+        destroy(slot);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer, move up to n elements to out, return how many were popped
+    template <typename OutputIter>
+    size_type pop_n(OutputIter out, size_type n)
+    {
+        auto head = m_head.load(std::memory_order_relaxed);
+        m_tail_cache = m_tail.load(std::memory_order_acquire);
+        n = std::min(n, m_tail_cache - head);
+
+        const auto num_popped = n;
+        while (n > 0) {
+            auto slot = consumer_slot(head);
+            const auto count = std::min(n, m_head_block_start + SUBARRAY_SIZE - head);
+            out = std::move(slot, slot + count, out);
+            std::for_each(slot, slot + count, [](value_type& value) { destroy(&value); });
+            head += count;
+            n -= count;
+            m_head.store(head, std::memory_order_release);
+        }
+
+        return num_popped;
+    }
+
+    // Either thread, only a snapshot while the other thread is running
+    size_type size() const
+    {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+    bool empty() const { return size() == 0; }
+
+private:
+    using Subarray = detail::SubarrayT<T, SUBARRAY_SIZE, Alloc>;
+
+    struct Block {
+        T* data;
+        std::atomic<Block*> next;
+    };
+
+    static Block* make_block()
+    {
+        Alloc alloc;
+        auto block = static_cast<Block*>(alloc_memory(alloc, size_of<Block>, align_of<Block>));
+        if (block == nullptr) {
+            throw std::bad_alloc {};
+        }
+
+        try {
+            ::new(static_cast<void*>(block)) Block {Subarray::allocate(), {nullptr}};
+        } catch (...) {
+            dealloc_memory(alloc, block, size_of<Block>);
+            throw;
+        }
+
+        return block;
+    }
+
+    static void free_block(Block* block)
+    {
+        Subarray::deallocate(block->data);
+        Alloc alloc;
+        dealloc_memory(alloc, block, size_of<Block>);
+    }
+
+    // Slot of the element pushed at tail, moves on to a new block when the current one is full
+    T* producer_slot(size_type tail)
+    {
+        if (tail == m_tail_block_start + SUBARRAY_SIZE) {
+            auto block = next_block();
+
+            // The consumer reads the link after it has seen the new tail, which is stored with release
+            m_tail_block->next.store(block, std::memory_order_relaxed);
+            m_tail_block = block;
+            m_tail_block_start = tail;
+        }
+
+        return m_tail_block->data + (tail - m_tail_block_start);
+    }
+
+    // The oldest block if the consumer is done with it, a new block otherwise
+    Block* next_block()
+    {
+        if (m_first == m_head_block.load(std::memory_order_acquire)) {
+            return make_block();
+        }
+
+        auto block = m_first;
+        m_first = block->next.load(std::memory_order_relaxed);
+        block->next.store(nullptr, std::memory_order_relaxed);
+        return block;
+    }
+
+    // Slot of the element popped at head, hands the current block over to the producer once it has been read
+    T* consumer_slot(size_type head)
+    {
+        auto block = m_head_block.load(std::memory_order_relaxed);
+        if (head == m_head_block_start + SUBARRAY_SIZE) {
+            block = block->next.load(std::memory_order_relaxed);
+            m_head_block.store(block, std::memory_order_release);
+            m_head_block_start = head;
+        }
+
+        return block->data + (head - m_head_block_start);
+    }
+
+    // Producer side
+    alignas(CACHE_LINE_SIZE) std::atomic<size_type> m_tail {0};
+    Block* m_tail_block = nullptr;
+    size_type m_tail_block_start = 0;
+
+    // Oldest block in the list, blocks from here up to the consumer's block are free to reuse
+    Block* m_first = nullptr;
+
+    // Consumer side
+    alignas(CACHE_LINE_SIZE) std::atomic<size_type> m_head {0};
+    std::atomic<Block*> m_head_block {nullptr};
+    size_type m_head_block_start = 0;
+
+    // Last tail seen by the consumer, saves reading the producer's cache line while there are elements left
+    size_type m_tail_cache = 0;
+};
+CLS_END
@@ -0,0 +1,204 @@
+/////////////////////////////////////////////////////////////////////////////////
+// The MIT License(MIT)
+//
+// Copyright (c) 2016 Tiangang Song
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+/////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include "allocator.h"
+
+CLS_BEGIN
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// WorkStealingDeque
+// Chase-Lev deque for task scheduling. The owner thread pushes and pops at the bottom, any number of thieves steal
+// from the top, and the only point where they contend is a CAS on top when they go for the same element.
+// Elements live in a circular array of power of two capacity. When it is full the owner copies the elements to an
+// array twice as large and publishes it, thieves keep reading the old one in the meantime, so growing never blocks.
+// Old arrays are freed by the destructor. T is copied in and out of atomic slots, so it has to be trivially copyable,
+// a task pointer or index typically.
+template <typename T, typename Alloc = ActiveAllocatorPolicy>
+class WorkStealingDeque {
+    static_assert(std::is_trivially_copyable<T>::value, "WorkStealingDeque elements must be trivially copyable");
+
+public:
+    using value_type = T;
+
+    static constexpr size_type DEFAULT_CAPACITY = 256;
+
+    explicit WorkStealingDeque(size_type capacity = DEFAULT_CAPACITY)
+    {
+        size_type pow2_capacity = 1;
+        while (pow2_capacity < capacity) {
+            pow2_capacity *= 2;
+        }
+
+        m_array.store(make_array(pow2_capacity), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    ~WorkStealingDeque()
+    {
+        free_array(m_array.load(std::memory_order_relaxed));
+        for (auto array : m_retired) {
+            free_array(array);
+        }
+    }
+
+    // Owner
+    void push(value_type value)
+    {
+        const auto bottom = m_bottom.load(std::memory_order_relaxed);
+        const auto top = m_top.load(std::memory_order_acquire);
+        auto array = m_array.load(std::memory_order_relaxed);
+        if (bottom - top > array->mask) {
+            array = grow(array, top, bottom);
+        }
+
+        array->put(bottom, value);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    // Owner, take the most recently pushed element, return false if the deque is empty
+    bool pop(value_type& value)
+    {
+        const auto bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+        auto array = m_array.load(std::memory_order_relaxed);
+        m_bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto top = m_top.load(std::memory_order_relaxed);
+
+        if (top > bottom) {
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        const auto popped = array->get(bottom);
+        if (top == bottom) {
+            // Last element, race the thieves for it
+            const auto won = m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                                           std::memory_order_relaxed);
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            if (!won) {
+                return false;
+            }
+        }
+
+        value = popped;
+        return true;
+    }
+
+    // Thief, take the oldest element, return false if the deque is empty or another thread took it first
+    bool steal(value_type& value)
+    {
+        auto top = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const auto bottom = m_bottom.load(std::memory_order_acquire);
+        if (top >= bottom) {
+            return false;
+        }
+
+        // The element has to be read before the CAS, afterwards the owner may overwrite its slot
+        auto array = m_array.load(std::memory_order_acquire);
+        auto stolen = array->get(top);
+        if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return false;
+        }
+
+        value = stolen;
+        return true;
+    }
+
+    // Any thread, only a snapshot while other threads are running
+    size_type size() const
+    {
+        const auto bottom = m_bottom.load(std::memory_order_acquire);
+        const auto top = m_top.load(std::memory_order_acquire);
+        return bottom > top ? bottom - top : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    size_type capacity() const { return m_array.load(std::memory_order_acquire)->mask + 1; }
+
+private:
+    // Circular array, the slots follow the header in the same allocation
+    struct alignas(std::atomic<T>) Array {
+        size_type mask;
+
+        std::atomic<T>* slots() { return reinterpret_cast<std::atomic<T>*>(this + 1); }
+
+        T get(size_type i) { return slots()[i & mask].load(std::memory_order_relaxed); }
+        void put(size_type i, T value) { slots()[i & mask].store(value, std::memory_order_relaxed); }
+
+        static size_type bytes(size_type capacity) { return size_of<Array> + size_of<std::atomic<T>> * capacity; }
+    };
+
+    static Array* make_array(size_type capacity)
+    {
+        Alloc alloc;
+        auto array = static_cast<Array*>(alloc_memory(alloc, Array::bytes(capacity), align_of<Array>));
+        if (array == nullptr) {
+            throw std::bad_alloc {};
+        }
+
+        array->mask = capacity - 1;
+        for (size_type i = 0; i < capacity; ++i) {
+            ::new(static_cast<void*>(array->slots() + i)) std::atomic<T>;
+        }
+
+        return array;
+    }
+
+    static void free_array(Array* array)
+    {
+        Alloc alloc;
+        dealloc_memory(alloc, array, Array::bytes(array->mask + 1));
+    }
+
+    // Copy [top, bottom) to an array twice as large and publish it. Thieves may still be reading the old array, so it
+    // is kept until the destructor
+    Array* grow(Array* array, size_type top, size_type bottom)
+    {
+        m_retired.reserve(m_retired.size() + 1);
+        auto new_array = make_array((array->mask + 1) * 2);
+        for (auto i = top; i != bottom; ++i) {
+            new_array->put(i, array->get(i));
+        }
+
+        m_retired.push_back(array);
+        m_array.store(new_array, std::memory_order_release);
+        return new_array;
+    }
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_type> m_top {0};
+    alignas(CACHE_LINE_SIZE) std::atomic<size_type> m_bottom {0};
+    std::atomic<Array*> m_array {nullptr};
+
+    // Arrays replaced by grow(), owner only
+    std::vector<Array*> m_retired;
+};
+CLS_END
@@ -22,29 +22,1695 @@
 // SOFTWARE.
 /////////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
 #include <cls_ex/allocator.h>
 
+#if defined(__GLIBC__) || defined(__APPLE__)
+#  include <execinfo.h>
+#  define CLS_HAS_BACKTRACE 1
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
 CLS_BEGIN
 // Default active allocator
 std::unique_ptr<Allocator> ActiveAllocator::m_allocator = std::make_unique<DefaultAllocator>();
+std::atomic<Allocator*> ActiveAllocator::m_global {ActiveAllocator::m_allocator.get()};
+thread_local Allocator* ActiveAllocator::m_thread_active = nullptr;
+std::mutex ActiveAllocator::m_reset_mtx;
+std::vector<std::unique_ptr<Allocator>> ActiveAllocator::m_retired;
+
+void ActiveAllocator::reset(std::unique_ptr<Allocator>&& alloc)
+{
+    std::lock_guard<std::mutex> lock {m_reset_mtx};
+    m_retired.reserve(m_retired.size() + 1);
+    m_global.store(alloc.get(), std::memory_order_release);
+    m_retired.push_back(std::move(m_allocator));
+    m_allocator = std::move(alloc);
+}
 
 Allocator::~Allocator() = default;
 
+bool Allocator::try_expand(void*, size_type old_n, size_type new_n)
+{
+    return new_n == old_n;
+}
+
+size_type Allocator::allocate_bulk(size_type count, size_type n, size_type alignment, void** out)
+{
+    for (size_type i = 0; i < count; ++i) {
+        out[i] = alignment <= MIN_ALIGNMENT ? allocate(n) : allocate(n, alignment);
+        if (out[i] == nullptr) {
+            return i;
+        }
+    }
+
+    return count;
+}
+
+void Allocator::deallocate_bulk(size_type count, size_type n, void* const* ptrs)
+{
+    for (size_type i = 0; i < count; ++i) {
+        deallocate(ptrs[i], n);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// HeapProfiler
+constexpr size_type HeapProfiler::DEFAULT_SAMPLE_INTERVAL;
+constexpr int HeapProfiler::MAX_FRAMES;
+constexpr size_type HeapProfiler::FILTER_SIZE;
+
+std::atomic<bool> HeapProfiler::m_sampling {false};
+std::atomic<bool> HeapProfiler::m_tracking {false};
+std::array<std::atomic<std::uint16_t>, HeapProfiler::FILTER_SIZE> HeapProfiler::m_filter {};
+thread_local size_type HeapProfiler::m_bytes_until_sample = 0;
+
+namespace {
+struct HeapSite {
+    std::vector<void*> frames;
+    size_type live_count  = 0;
+    size_type live_bytes  = 0;
+    size_type alloc_count = 0;
+    size_type alloc_bytes = 0;
+
+    // Unsampled estimate of the live bytes
+    double live_estimate = 0;
+};
+
+struct HeapSample {
+    size_type site;
+    size_type size;
+    double estimate;
+};
+
+struct HeapProfile {
+    std::mutex mtx;
+    size_type sample_interval = HeapProfiler::DEFAULT_SAMPLE_INTERVAL;
+    std::uint64_t generation = 0;
+
+    std::vector<HeapSite> sites;
+    std::map<std::vector<void*>, size_type> site_index;
+    std::unordered_map<void*, HeapSample> samples;
+};
+
+HeapProfile& heap_profile()
+{
+    static HeapProfile profile;
+    return profile;
+}
+
+// A thread starts counting anew when it sees a new generation, i.e. after start()
+thread_local std::uint64_t t_heap_generation = 0;
+thread_local std::uint64_t t_heap_rng = 0;
+
+// Distance to the next sample, exponentially distributed with mean interval so that samples are not in lockstep
+// with allocation patterns
+size_type next_sample_distance(size_type interval)
+{
+    if (t_heap_rng == 0) {
+        t_heap_rng = static_cast<std::uint64_t>(std::hash<std::thread::id> {}(std::this_thread::get_id())) | 1;
+    }
+
+    // xorshift64
+    t_heap_rng ^= t_heap_rng << 13;
+    t_heap_rng ^= t_heap_rng >> 7;
+    t_heap_rng ^= t_heap_rng << 17;
+
+    const auto u = (double(t_heap_rng >> 11) + 1) / double(std::uint64_t {1} << 53);
+    return static_cast<size_type>(-std::log(u) * double(interval)) + 1;
+}
+
+int capture_stack(void** frames, int max_frames)
+{
+#if CLS_HAS_BACKTRACE
+    return backtrace(frames, max_frames);
+#else
+    (void)frames;
+    (void)max_frames;
+    return 0;
+#endif
+}
+}
+
+void HeapProfiler::start(size_type sample_interval)
+{
+    auto& profile = heap_profile();
+    {
+        std::lock_guard<std::mutex> lock(profile.mtx);
+        profile.sample_interval = sample_interval;
+        ++profile.generation;
+    }
+
+    m_tracking.store(true, std::memory_order_relaxed);
+    m_sampling.store(true, std::memory_order_relaxed);
+}
+
+void HeapProfiler::stop()
+{
+    m_sampling.store(false, std::memory_order_relaxed);
+}
+
+void HeapProfiler::reset()
+{
+    m_sampling.store(false, std::memory_order_relaxed);
+    m_tracking.store(false, std::memory_order_relaxed);
+
+    auto& profile = heap_profile();
+    std::lock_guard<std::mutex> lock(profile.mtx);
+    profile.sites.clear();
+    profile.site_index.clear();
+    profile.samples.clear();
+    for (auto& slot : m_filter) {
+        slot.store(0, std::memory_order_relaxed);
+    }
+}
+
+void HeapProfiler::sample(void* p, size_type n)
+{
+    // Skip this frame
+    void* frames[MAX_FRAMES + 1];
+    const auto depth = capture_stack(frames, MAX_FRAMES + 1);
+
+    auto& profile = heap_profile();
+    std::lock_guard<std::mutex> lock(profile.mtx);
+    const auto interval = profile.sample_interval;
+    m_bytes_until_sample = next_sample_distance(interval);
+    if (t_heap_generation != profile.generation) {
+        t_heap_generation = profile.generation;
+        return;
+    }
+
+    std::vector<void*> stack(frames + std::min(depth, 1), frames + depth);
+    auto iter = profile.site_index.find(stack);
+    if (iter == profile.site_index.end()) {
+        iter = profile.site_index.emplace(stack, static_cast<size_type>(profile.sites.size())).first;
+        profile.sites.emplace_back();
+        profile.sites.back().frames = std::move(stack);
+    }
+
+    // A block of n bytes is sampled with probability 1 - exp(-n / interval)
+    const auto estimate = double(n) / (1 - std::exp(-double(n) / double(interval)));
+
+    auto& site = profile.sites[iter->second];
+    ++site.live_count;
+    site.live_bytes += n;
+    ++site.alloc_count;
+    site.alloc_bytes += n;
+    site.live_estimate += estimate;
+
+    // The block may have been freed behind our back, e.g. by calling the allocator directly
+    auto old_sample = profile.samples.find(p);
+    if (old_sample != profile.samples.end()) {
+        auto& old_site = profile.sites[old_sample->second.site];
+        --old_site.live_count;
+        old_site.live_bytes -= old_sample->second.size;
+        old_site.live_estimate -= old_sample->second.estimate;
+        profile.samples.erase(old_sample);
+    } else {
+        m_filter[filter_index(p)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    profile.samples.emplace(p, HeapSample {iter->second, n, estimate});
+}
+
+void HeapProfiler::forget(void* p)
+{
+    auto& profile = heap_profile();
+    std::lock_guard<std::mutex> lock(profile.mtx);
+    auto iter = profile.samples.find(p);
+    if (iter == profile.samples.end()) {
+        return;
+    }
+
+    auto& site = profile.sites[iter->second.site];
+    --site.live_count;
+    site.live_bytes -= iter->second.size;
+    site.live_estimate -= iter->second.estimate;
+
+    m_filter[filter_index(p)].fetch_sub(1, std::memory_order_relaxed);
+    profile.samples.erase(iter);
+}
+
+void HeapProfiler::report(std::ostream& os, size_type max_sites)
+{
+    auto& profile = heap_profile();
+    std::lock_guard<std::mutex> lock(profile.mtx);
+
+    std::vector<const HeapSite*> sites;
+    double total_estimate = 0;
+    for (const auto& site : profile.sites) {
+        if (site.live_count > 0) {
+            sites.push_back(&site);
+            total_estimate += site.live_estimate;
+        }
+    }
+    std::sort(sites.begin(), sites.end(),
+              [](const HeapSite* lhs, const HeapSite* rhs) { return lhs->live_estimate > rhs->live_estimate; });
+
+    os << "heap profile: " << profile.samples.size() << " live samples, about " << llong(total_estimate)
+       << " live bytes, sampled every " << profile.sample_interval << " bytes\n";
+
+    for (size_type i = 0; i < std::min(max_sites, static_cast<size_type>(sites.size())); ++i) {
+        const auto& site = *sites[i];
+        os << "about " << llong(site.live_estimate) << " live bytes, " << site.live_count << " of "
+           << site.alloc_count << " sampled allocations live\n";
+
+#if CLS_HAS_BACKTRACE
+        auto symbols = backtrace_symbols(site.frames.data(), static_cast<int>(site.frames.size()));
+        for (size_t j = 0; j < site.frames.size(); ++j) {
+            os << "    " << (symbols != nullptr ? symbols[j] : "?") << "\n";
+        }
+        std::free(symbols);
+#else
+        for (auto frame : site.frames) {
+            os << "    " << frame << "\n";
+        }
+#endif
+    }
+}
+
+void HeapProfiler::write_pprof(std::ostream& os)
+{
+    auto& profile = heap_profile();
+    std::lock_guard<std::mutex> lock(profile.mtx);
+
+    HeapSite total;
+    for (const auto& site : profile.sites) {
+        total.live_count += site.live_count;
+        total.live_bytes += site.live_bytes;
+        total.alloc_count += site.alloc_count;
+        total.alloc_bytes += site.alloc_bytes;
+    }
+
+    // pprof does the unsampling itself given the sampling interval
+    auto write_counts = [&os](const HeapSite& site) {
+        os << site.live_count << ": " << site.live_bytes << " [" << site.alloc_count << ": " << site.alloc_bytes
+           << "] @";
+    };
+
+    os << "heap profile: ";
+    write_counts(total);
+    os << " heap_v2/" << profile.sample_interval << "\n";
+
+    for (const auto& site : profile.sites) {
+        write_counts(site);
+        for (auto frame : site.frames) {
+            os << " " << frame;
+        }
+        os << "\n";
+    }
+
+    // Lets pprof map addresses to binaries
+    std::ifstream maps("/proc/self/maps");
+    if (maps) {
+        os << "\nMAPPED_LIBRARIES:\n" << maps.rdbuf();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// PoolAllocator
+constexpr size_type PoolAllocator::MIN_CLASS_SIZE;
+constexpr size_type PoolAllocator::MAX_CLASS_SIZE;
+constexpr size_type PoolAllocator::NUM_CLASSES;
+constexpr size_type PoolAllocator::CHUNK_SIZE;
+
+namespace {
+static_assert((PoolAllocator::MIN_CLASS_SIZE << (PoolAllocator::NUM_CLASSES - 1)) == PoolAllocator::MAX_CLASS_SIZE,
+              "Size classes do not cover [MIN_CLASS_SIZE, MAX_CLASS_SIZE]");
+static_assert(PoolAllocator::CHUNK_SIZE >= 2 * PoolAllocator::MAX_CLASS_SIZE, "Chunk is too small");
+
+// Unique id for every pool ever created, so a stale thread-local lookup can never match a new pool
+std::atomic<std::uint64_t> g_pool_id {0};
+
+// Caches of the pools used last by this thread, most recent first, keeps the lookup to a single compare in the
+// common case
+struct PoolCacheEntry {
+    std::uint64_t pool_id;
+    void* cache;
+};
+
+thread_local std::array<PoolCacheEntry, PoolAllocator::MAX_THREAD_POOLS> t_pool_caches {};
+
+// Set when the thread's exit guard runs, trivially destructible so it can still be read after the guard is gone
+thread_local bool t_pool_exiting = false;
+
+// Pools alive, so an exiting thread can tell which of the pools it used it may still touch
+std::mutex g_pools_mtx;
+std::unordered_map<std::uint64_t, PoolAllocator*> g_pools;
+
+inline size_type class_index(size_type n)
+{
+    if (n <= PoolAllocator::MIN_CLASS_SIZE) {
+        return 0;
+    }
+
+#if defined(__GNUC__) || defined(__clang__)
+    return (64 - __builtin_clzll(static_cast<ullong>(n - 1))) - 4;
+#else
+    size_type idx = 0;
+    for (auto class_size = PoolAllocator::MIN_CLASS_SIZE; class_size < n; class_size <<= 1) {
+        ++idx;
+    }
+    return idx;
+#endif
+}
+
+inline size_type class_size(size_type class_idx)
+{
+    return PoolAllocator::MIN_CLASS_SIZE << class_idx;
+}
+
+// Number of blocks moved between a thread cache and the central list at once
+inline size_type batch_size(size_type class_idx)
+{
+    return std::min<size_type>(64, std::max<size_type>(2, PoolAllocator::CHUNK_SIZE / class_size(class_idx) / 8));
+}
+
+// Chunks in REMOTE mode are aligned to their size so a block finds its header, and hold at least 64 blocks as the
+// header takes up one
+inline size_type remote_chunk_size(size_type class_idx)
+{
+    return std::max(PoolAllocator::CHUNK_SIZE, class_size(class_idx) * 64);
+}
+}
+
+struct PoolAllocator::ThreadExitGuard {
+    // Pools this thread has a cache in
+    std::vector<std::uint64_t> pool_ids;
+
+    ~ThreadExitGuard()
+    {
+        t_pool_exiting = true;
+        t_pool_caches = {};
+
+        // A pool can't be destroyed while we hold the lock
+        std::lock_guard<std::mutex> lock(g_pools_mtx);
+        for (auto id : pool_ids) {
+            auto iter = g_pools.find(id);
+            if (iter != g_pools.end()) {
+                iter->second->release_thread_cache();
+            }
+        }
+    }
+};
+
+thread_local PoolAllocator::ThreadExitGuard PoolAllocator::m_exit_guard;
+
+PoolAllocator::PoolAllocator(FreeMode free_mode) : m_id {++g_pool_id}, m_free_mode {free_mode}
+{
+    std::lock_guard<std::mutex> lock(g_pools_mtx);
+    g_pools.emplace(m_id, this);
+}
+
+PoolAllocator::~PoolAllocator()
+{
+    {
+        std::lock_guard<std::mutex> lock(g_pools_mtx);
+        g_pools.erase(m_id);
+    }
+
+    for (auto chunk : m_chunks) {
+        boost::alignment::aligned_free(chunk);
+    }
+}
+
+void* PoolAllocator::allocate(size_type n)
+{
+    if (n > MAX_CLASS_SIZE) {
+        return boost::alignment::aligned_alloc(static_cast<size_t>(MIN_ALIGNMENT), static_cast<size_t>(n));
+    }
+
+    const auto class_idx = class_index(n);
+    std::unique_lock<std::mutex> exit_lock;
+    auto& cache = thread_cache(exit_lock);
+    auto& list = cache.lists[class_idx];
+    if (list.head != nullptr) {
+        return list.pop();
+    }
+
+    return refill(class_idx, cache);
+}
+
+void* PoolAllocator::allocate(size_type n, size_type alignment)
+{
+    if (n > MAX_CLASS_SIZE) {
+        return boost::alignment::aligned_alloc(
+            static_cast<size_t>(std::max(MIN_ALIGNMENT, alignment)), static_cast<size_t>(n));
+    }
+
+    // Blocks are aligned to their class size, deallocate() only knows n so we can't pick a bigger class here
+    if (alignment > class_size(class_index(n))) {
+        return nullptr;
+    }
+
+    return PoolAllocator::allocate(n);
+}
+
+void PoolAllocator::deallocate(void* p, size_type n)
+{
+    if (p == nullptr) {
+        return;
+    }
+
+    if (n > MAX_CLASS_SIZE) {
+        boost::alignment::aligned_free(p);
+        return;
+    }
+
+    const auto class_idx = class_index(n);
+    std::unique_lock<std::mutex> exit_lock;
+    auto& cache = thread_cache(exit_lock);
+    if (m_free_mode == FreeMode::REMOTE) {
+        free_remote(class_idx, cache, static_cast<FreeBlock*>(p));
+        return;
+    }
+
+    auto& list = cache.lists[class_idx];
+    list.push(static_cast<FreeBlock*>(p));
+
+    const auto batch = batch_size(class_idx);
+    if (list.count >= 2 * batch) {
+        flush(class_idx, list, batch);
+    }
+}
+
+bool PoolAllocator::try_expand(void*, size_type old_n, size_type new_n)
+{
+    if (old_n > MAX_CLASS_SIZE || new_n > MAX_CLASS_SIZE) {
+        return new_n == old_n;
+    }
+
+    return class_index(old_n) == class_index(new_n);
+}
+
+size_type PoolAllocator::allocate_bulk(size_type count, size_type n, size_type alignment, void** out)
+{
+    if (n > MAX_CLASS_SIZE || alignment > class_size(class_index(n))) {
+        return Allocator::allocate_bulk(count, n, alignment, out);
+    }
+
+    const auto class_idx = class_index(n);
+    std::unique_lock<std::mutex> exit_lock;
+    auto& cache = thread_cache(exit_lock);
+    auto& list = cache.lists[class_idx];
+    for (size_type i = 0; i < count; ++i) {
+        out[i] = list.head != nullptr ? list.pop() : refill(class_idx, cache);
+        if (out[i] == nullptr) {
+            return i;
+        }
+    }
+
+    return count;
+}
+
+void PoolAllocator::deallocate_bulk(size_type count, size_type n, void* const* ptrs)
+{
+    if (n > MAX_CLASS_SIZE) {
+        Allocator::deallocate_bulk(count, n, ptrs);
+        return;
+    }
+
+    const auto class_idx = class_index(n);
+    std::unique_lock<std::mutex> exit_lock;
+    auto& cache = thread_cache(exit_lock);
+    if (m_free_mode == FreeMode::REMOTE) {
+        for (size_type i = 0; i < count; ++i) {
+            if (ptrs[i] != nullptr) {
+                free_remote(class_idx, cache, static_cast<FreeBlock*>(ptrs[i]));
+            }
+        }
+        return;
+    }
+
+    auto& list = cache.lists[class_idx];
+    for (size_type i = 0; i < count; ++i) {
+        if (ptrs[i] != nullptr) {
+            list.push(static_cast<FreeBlock*>(ptrs[i]));
+        }
+    }
+
+    const auto batch = batch_size(class_idx);
+    if (list.count >= 2 * batch) {
+        flush(class_idx, list, list.count - batch);
+    }
+}
+
+PoolAllocator::ThreadCache& PoolAllocator::thread_cache(std::unique_lock<std::mutex>& exit_lock)
+{
+    if (t_pool_caches[0].pool_id == m_id) {
+        return *static_cast<ThreadCache*>(t_pool_caches[0].cache);
+    }
+
+    return thread_cache_slow(exit_lock);
+}
+
+PoolAllocator::ThreadCache& PoolAllocator::thread_cache_slow(std::unique_lock<std::mutex>& exit_lock)
+{
+    // The exit guard may already be destroyed, e.g. when a thread_local container frees its memory after it
+    if (t_pool_exiting) {
+        exit_lock = std::unique_lock<std::mutex> {m_exit_mtx};
+        return m_exit_cache;
+    }
+
+    // Move our entry to the front, or make room there for it
+    auto entry = std::find_if(t_pool_caches.begin(), t_pool_caches.end(),
+                              [this](const PoolCacheEntry& e) { return e.pool_id == m_id; });
+    if (entry != t_pool_caches.end()) {
+        std::rotate(t_pool_caches.begin(), entry, std::next(entry));
+        return *static_cast<ThreadCache*>(t_pool_caches[0].cache);
+    }
+
+    const auto tid = std::this_thread::get_id();
+    ThreadCache* cache = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        auto iter = std::find_if(m_caches.begin(), m_caches.end(),
+                                 [tid](const auto& e) { return e.first == tid; });
+        if (iter == m_caches.end()) {
+            // Adopt the cache of an exited thread, or make a new one
+            iter = std::find_if(m_caches.begin(), m_caches.end(),
+                                [](const auto& e) { return e.first == std::thread::id {}; });
+            if (iter == m_caches.end()) {
+                m_caches.emplace_back(tid, std::make_unique<ThreadCache>());
+                iter = std::prev(m_caches.end());
+            }
+            iter->first = tid;
+
+            auto& pool_ids = m_exit_guard.pool_ids;
+            if (std::find(pool_ids.begin(), pool_ids.end(), m_id) == pool_ids.end()) {
+                pool_ids.push_back(m_id);
+            }
+        }
+        cache = iter->second.get();
+    }
+
+    std::rotate(t_pool_caches.begin(), std::prev(t_pool_caches.end()), t_pool_caches.end());
+    t_pool_caches[0] = {m_id, cache};
+
+    return *cache;
+}
+
+void PoolAllocator::release_thread_cache()
+{
+    const auto tid = std::this_thread::get_id();
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    auto iter = std::find_if(m_caches.begin(), m_caches.end(), [tid](const auto& e) { return e.first == tid; });
+    if (iter == m_caches.end()) {
+        return;
+    }
+
+    // In REMOTE mode the blocks stay in the cache, with the chunks it owns
+    if (m_free_mode == FreeMode::CENTRAL) {
+        auto& cache = *iter->second;
+        for (size_type class_idx = 0; class_idx < NUM_CLASSES; ++class_idx) {
+            flush(class_idx, cache.lists[class_idx], cache.lists[class_idx].count);
+        }
+    }
+    iter->first = std::thread::id {};
+}
+
+void* PoolAllocator::refill(size_type class_idx, ThreadCache& cache)
+{
+    if (m_free_mode == FreeMode::REMOTE) {
+        return refill_remote(class_idx, cache);
+    }
+
+    auto& list = cache.lists[class_idx];
+    const auto batch = batch_size(class_idx);
+    auto& central = m_central[class_idx];
+
+    {
+        std::lock_guard<std::mutex> lock(central.mtx);
+        while (list.count < batch && central.list.head != nullptr) {
+            list.push(central.list.pop());
+        }
+    }
+
+    if (list.head == nullptr) {
+        // Central list is exhausted, carve a new chunk. Chunks are aligned to the class size so every block is too.
+        const auto block_size = class_size(class_idx);
+        auto chunk = static_cast<char*>(boost::alignment::aligned_alloc(
+            static_cast<size_t>(block_size), static_cast<size_t>(CHUNK_SIZE)));
+        if (chunk == nullptr) {
+            return nullptr;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_chunks.push_back(chunk);
+        }
+
+        // Keep one batch in this thread, hand the rest to the central list
+        const auto num_blocks = CHUNK_SIZE / block_size;
+        size_type i = 0;
+        for (; i < std::min(batch, num_blocks); ++i) {
+            list.push(reinterpret_cast<FreeBlock*>(chunk + i * block_size));
+        }
+
+        if (i < num_blocks) {
+            std::lock_guard<std::mutex> lock(central.mtx);
+            for (; i < num_blocks; ++i) {
+                central.list.push(reinterpret_cast<FreeBlock*>(chunk + i * block_size));
+            }
+        }
+    }
+
+    return list.pop();
+}
+
+void* PoolAllocator::refill_remote(size_type class_idx, ThreadCache& cache)
+{
+    auto& list = cache.lists[class_idx];
+
+    // Other threads only ever push, so taking the whole list at once is free of ABA
+    auto block = cache.remote_lists[class_idx].exchange(nullptr, std::memory_order_acquire);
+    while (block != nullptr) {
+        list.push(std::exchange(block, block->next));
+    }
+
+    if (list.head == nullptr) {
+        const auto block_size = class_size(class_idx);
+        const auto chunk_size = remote_chunk_size(class_idx);
+        auto chunk = static_cast<char*>(boost::alignment::aligned_alloc(
+            static_cast<size_t>(chunk_size), static_cast<size_t>(chunk_size)));
+        if (chunk == nullptr) {
+            return nullptr;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_chunks.push_back(chunk);
+        }
+
+        ::new(static_cast<void*>(chunk)) ChunkHeader {&cache};
+        for (auto i = chunk_size / block_size - 1; i > 0; --i) {
+            list.push(reinterpret_cast<FreeBlock*>(chunk + i * block_size));
+        }
+    }
+
+    return list.pop();
+}
+
+void PoolAllocator::free_remote(size_type class_idx, ThreadCache& cache, FreeBlock* block)
+{
+    const auto mask = static_cast<std::uintptr_t>(remote_chunk_size(class_idx) - 1);
+    const auto header = reinterpret_cast<ChunkHeader*>(reinterpret_cast<std::uintptr_t>(block) & ~mask);
+    if (header->owner == &cache) {
+        cache.lists[class_idx].push(block);
+        return;
+    }
+
+    auto& remote_list = header->owner->remote_lists[class_idx];
+    auto head = remote_list.load(std::memory_order_relaxed);
+    do {
+        block->next = head;
+    } while (!remote_list.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void PoolAllocator::flush(size_type class_idx, FreeList& cache, size_type count)
+{
+    auto& central = m_central[class_idx];
+
+    std::lock_guard<std::mutex> lock(central.mtx);
+    while (count-- > 0) {
+        central.list.push(cache.pop());
+    }
+}
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-// DefaultAllocator
-void* DefaultAllocator::allocate(size_type n)
+// ArenaAllocator
+constexpr size_type ArenaAllocator::DEFAULT_CHUNK_SIZE;
+constexpr size_type ArenaAllocator::CHUNK_HEADER_SIZE;
+
+ArenaAllocator::ArenaAllocator(size_type chunk_size) : m_chunk_size {chunk_size}
+{
+}
+
+ArenaAllocator::~ArenaAllocator()
+{
+    while (m_chunk != nullptr) {
+        boost::alignment::aligned_free(std::exchange(m_chunk, m_chunk->prev));
+    }
+}
+
+void* ArenaAllocator::allocate(size_type n)
+{
+    return ArenaAllocator::allocate(n, MIN_ALIGNMENT);
+}
+
+void* ArenaAllocator::allocate(size_type n, size_type alignment)
+{
+    alignment = std::max(MIN_ALIGNMENT, alignment);
+
+    const auto mask = static_cast<std::uintptr_t>(alignment - 1);
+    const auto p = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(m_current) + mask) & ~mask);
+    if (m_current == nullptr || n > m_end - p) {
+        return allocate_from_new_chunk(n, alignment);
+    }
+
+    m_current = p + n;
+    m_used += n;
+
+    return p;
+}
+
+bool ArenaAllocator::try_expand(void* p, size_type old_n, size_type new_n)
+{
+    auto block = static_cast<char*>(p);
+    if (block + old_n != m_current || new_n > m_end - block) {
+        return new_n == old_n;
+    }
+
+    m_current = block + new_n;
+    m_used += new_n - old_n;
+
+    return true;
+}
+
+void ArenaAllocator::reset()
+{
+    if (m_chunk == nullptr) {
+        return;
+    }
+
+    while (m_chunk->prev != nullptr) {
+        boost::alignment::aligned_free(std::exchange(m_chunk->prev, m_chunk->prev->prev));
+    }
+
+    m_current = reinterpret_cast<char*>(m_chunk) + CHUNK_HEADER_SIZE;
+    m_used = 0;
+}
+
+void* ArenaAllocator::allocate_from_new_chunk(size_type n, size_type alignment)
+{
+    // Oversized requests get a chunk of their own
+    const auto chunk_size = std::max(m_chunk_size, CHUNK_HEADER_SIZE + n + alignment);
+    auto chunk = static_cast<char*>(boost::alignment::aligned_alloc(
+        static_cast<size_t>(MIN_ALIGNMENT), static_cast<size_t>(chunk_size)));
+    if (chunk == nullptr) {
+        return nullptr;
+    }
+
+    m_chunk = ::new(static_cast<void*>(chunk)) Chunk {m_chunk};
+    m_current = chunk + CHUNK_HEADER_SIZE;
+    m_end = chunk + chunk_size;
+
+    return ArenaAllocator::allocate(n, alignment);
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// StackAllocator
+StackAllocator::StackAllocator(size_type capacity)
+    : m_begin {static_cast<char*>(boost::alignment::aligned_alloc(static_cast<size_t>(MIN_ALIGNMENT),
+                                                                   static_cast<size_t>(capacity)))},
+      m_top {m_begin},
+      m_end {m_begin != nullptr ? m_begin + capacity : nullptr}
 {
-    return boost::alignment::aligned_alloc(static_cast<size_t>(MIN_ALIGNMENT), static_cast<size_t>(n));
+    if (m_begin == nullptr) {
+        throw std::bad_alloc {};
+    }
 }
 
-void* DefaultAllocator::allocate(size_type n, size_type alignment)
+StackAllocator::~StackAllocator()
 {
-    return boost::alignment::aligned_alloc(
-        static_cast<size_t>(std::max(MIN_ALIGNMENT, alignment)), static_cast<size_t>(n));
+    boost::alignment::aligned_free(m_begin);
+}
+
+DoubleStackAllocator::DoubleStackAllocator(size_type capacity)
+    : m_begin {static_cast<char*>(boost::alignment::aligned_alloc(static_cast<size_t>(MIN_ALIGNMENT),
+                                                                   static_cast<size_t>(capacity)))},
+      m_bottom {m_begin},
+      m_top {m_begin != nullptr ? m_begin + capacity : nullptr},
+      m_end {m_top}
+{
+    if (m_begin == nullptr) {
+        throw std::bad_alloc {};
+    }
+}
+
+DoubleStackAllocator::~DoubleStackAllocator()
+{
+    boost::alignment::aligned_free(m_begin);
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// SlabAllocator
+constexpr size_type SlabAllocator::MIN_SLAB_SIZE;
+constexpr size_type SlabAllocator::MAX_SLABS;
+
+namespace {
+inline size_type round_up(size_type n, size_type alignment)
+{
+    return (n + alignment - 1) / alignment * alignment;
+}
+
+inline size_type next_pow2(size_type n)
+{
+    size_type pow2 = 1;
+    while (pow2 < n) {
+        pow2 <<= 1;
+    }
+    return pow2;
+}
+}
+
+SlabAllocator::SlabAllocator(size_type block_size, size_type alignment)
+    : m_block_size {block_size},
+      m_alignment {std::max({alignment, MIN_ALIGNMENT, align_of<std::atomic<Index>>})},
+      m_stride {round_up(std::max(block_size, size_of<std::atomic<Index>>), m_alignment)},
+      m_slab_size {next_pow2(std::max(MIN_SLAB_SIZE, 64 * m_stride))},
+      m_header_size {round_up(size_of<SlabHeader>, m_alignment)},
+      m_blocks_per_slab {(m_slab_size - m_header_size) / m_stride},
+      m_slabs {std::make_unique<std::atomic<char*>[]>(static_cast<size_t>(MAX_SLABS))}
+{
+    ASSERT((m_alignment & (m_alignment - 1)) == 0);
+}
+
+SlabAllocator::~SlabAllocator()
+{
+    for (size_type i = 0; i < m_num_slabs.load(std::memory_order_relaxed); ++i) {
+        boost::alignment::aligned_free(m_slabs[i].load(std::memory_order_relaxed));
+    }
+}
+
+void* SlabAllocator::allocate(size_type n)
+{
+    if (n != m_block_size) {
+        return m_upstream.allocate(n);
+    }
+
+    return pop();
+}
+
+void* SlabAllocator::allocate(size_type n, size_type alignment)
+{
+    if (n != m_block_size) {
+        return m_upstream.allocate(n, alignment);
+    }
+
+    // deallocate() only knows n, so we can't route over-aligned blocks elsewhere
+    if (alignment > m_alignment) {
+        return nullptr;
+    }
+
+    return pop();
+}
+
+void SlabAllocator::deallocate(void* p, size_type n)
+{
+    if (n != m_block_size) {
+        m_upstream.deallocate(p, n);
+    } else if (p != nullptr) {
+        push(p);
+    }
+}
+
+void* SlabAllocator::pop()
+{
+    auto head = m_head.load(std::memory_order_acquire);
+    while (true) {
+        const auto idx = static_cast<Index>(head);
+        if (idx == 0) {
+            if (!grow()) {
+                return nullptr;
+            }
+            head = m_head.load(std::memory_order_acquire);
+            continue;
+        }
+
+        // The block may be popped and reused by another thread meanwhile, in which case next is garbage but the tag
+        // has changed and the CAS fails. Slabs are never freed before the allocator, so the read itself is safe.
+        const auto block = block_ptr(idx);
+        const auto next = next_of(block).load(std::memory_order_relaxed);
+        const auto new_head = (((head >> 32) + 1) << 32) | next;
+        if (m_head.compare_exchange_weak(head, new_head, std::memory_order_acquire, std::memory_order_acquire)) {
+            return block;
+        }
+    }
+}
+
+void SlabAllocator::push(void* p)
+{
+    const auto idx = block_index(p);
+    auto& next = next_of(p);
+
+    auto head = m_head.load(std::memory_order_relaxed);
+    do {
+        next.store(static_cast<Index>(head), std::memory_order_relaxed);
+    } while (!m_head.compare_exchange_weak(head, (((head >> 32) + 1) << 32) | idx,
+                                           std::memory_order_release, std::memory_order_relaxed));
+}
+
+bool SlabAllocator::grow()
+{
+    std::lock_guard<std::mutex> lock(m_grow_mtx);
+
+    // Somebody else has grown while we were waiting
+    if (static_cast<Index>(m_head.load(std::memory_order_acquire)) != 0) {
+        return true;
+    }
+
+    const auto slab_idx = m_num_slabs.load(std::memory_order_relaxed);
+    if (slab_idx == MAX_SLABS) {
+        return false;
+    }
+
+    // Slabs are aligned to their size, so a block finds its slab header by masking its address
+    auto slab = static_cast<char*>(boost::alignment::aligned_alloc(
+        static_cast<size_t>(m_slab_size), static_cast<size_t>(m_slab_size)));
+    if (slab == nullptr) {
+        return false;
+    }
+
+    ::new(static_cast<void*>(slab)) SlabHeader {static_cast<Index>(slab_idx)};
+    m_slabs[slab_idx].store(slab, std::memory_order_release);
+    m_num_slabs.store(slab_idx + 1, std::memory_order_release);
+
+    // Link the blocks of the new slab, then splice the whole chain onto the list with one CAS
+    const auto first_idx = static_cast<Index>(slab_idx * m_blocks_per_slab + 1);
+    const auto last_idx = static_cast<Index>(first_idx + m_blocks_per_slab - 1);
+    for (auto idx = first_idx; idx < last_idx; ++idx) {
+        ::new(static_cast<void*>(block_ptr(idx))) std::atomic<Index> {static_cast<Index>(idx + 1)};
+    }
+    auto& last_next = *::new(static_cast<void*>(block_ptr(last_idx))) std::atomic<Index> {0};
+
+    auto head = m_head.load(std::memory_order_relaxed);
+    do {
+        last_next.store(static_cast<Index>(head), std::memory_order_relaxed);
+    } while (!m_head.compare_exchange_weak(head, (((head >> 32) + 1) << 32) | first_idx,
+                                           std::memory_order_release, std::memory_order_relaxed));
+
+    return true;
+}
+
+char* SlabAllocator::block_ptr(Index idx) const
+{
+    const auto slab_idx = static_cast<size_type>(idx - 1) / m_blocks_per_slab;
+    const auto block_idx = static_cast<size_type>(idx - 1) % m_blocks_per_slab;
+
+    return m_slabs[slab_idx].load(std::memory_order_acquire) + m_header_size + block_idx * m_stride;
+}
+
+SlabAllocator::Index SlabAllocator::block_index(void* p) const
+{
+    const auto addr = reinterpret_cast<std::uintptr_t>(p);
+    const auto slab = reinterpret_cast<char*>(addr & ~static_cast<std::uintptr_t>(m_slab_size - 1));
+    const auto slab_idx = static_cast<size_type>(reinterpret_cast<SlabHeader*>(slab)->slab_idx);
+    const auto block_idx = (static_cast<char*>(p) - slab - m_header_size) / m_stride;
+
+    return static_cast<Index>(slab_idx * m_blocks_per_slab + block_idx + 1);
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// HugePageAllocator
+constexpr size_type HugePageAllocator::HUGE_PAGE_SIZE;
+constexpr size_type HugePageAllocator::DEFAULT_REGION_SIZE;
+constexpr size_type HugePageAllocator::MAX_BLOCK_ALIGNMENT;
+constexpr size_type HugePageAllocator::NUM_CLASSES;
+
+namespace {
+inline size_type log2_ceil(size_type n)
+{
+    if (n <= 1) {
+        return 0;
+    }
+
+#if defined(__GNUC__) || defined(__clang__)
+    return 64 - __builtin_clzll(static_cast<ullong>(n - 1));
+#else
+    size_type exp = 0;
+    while ((size_type {1} << exp) < n) {
+        ++exp;
+    }
+    return exp;
+#endif
+}
+}
+
+HugePageAllocator::HugePageAllocator(size_type region_size)
+    : m_region_size {round_up(region_size, HUGE_PAGE_SIZE)}
+{
+}
+
+HugePageAllocator::~HugePageAllocator()
+{
+    for (const auto& region : m_regions) {
+        unmap_region(region);
+    }
+}
+
+void* HugePageAllocator::allocate(size_type n)
+{
+    return HugePageAllocator::allocate(n, MIN_ALIGNMENT);
+}
+
+void* HugePageAllocator::allocate(size_type n, size_type alignment)
+{
+    const auto class_idx = log2_ceil(std::max(n, MIN_ALIGNMENT));
+    const auto block_size = size_type {1} << class_idx;
+
+    if (block_size > m_region_size) {
+        // Mappings are huge page aligned
+        std::lock_guard<std::mutex> lock(m_mtx);
+        auto p = map_region(n);
+        if (p != nullptr) {
+            m_regions.push_back({p, round_up(n, HUGE_PAGE_SIZE)});
+        }
+        return p;
+    }
+
+    // Blocks are aligned to their class size, up to MAX_BLOCK_ALIGNMENT
+    const auto block_alignment = std::min(block_size, MAX_BLOCK_ALIGNMENT);
+    if (alignment > block_alignment) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (auto block = m_free_lists[class_idx]) {
+        m_free_lists[class_idx] = block->next;
+        return block;
+    }
+
+    auto mask = static_cast<std::uintptr_t>(block_alignment - 1);
+    auto p = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(m_current) + mask) & ~mask);
+    if (m_current == nullptr || block_size > m_end - p) {
+        // The rest of the current region is abandoned, it is small compared to the region
+        auto region = static_cast<char*>(map_region(m_region_size));
+        if (region == nullptr) {
+            return nullptr;
+        }
+        m_regions.push_back({region, m_region_size});
+        m_end = region + m_region_size;
+        p = region;
+    }
+
+    m_current = p + block_size;
+    return p;
+}
+
+void HugePageAllocator::deallocate(void* p, size_type n)
+{
+    if (p == nullptr) {
+        return;
+    }
+
+    const auto class_idx = log2_ceil(std::max(n, MIN_ALIGNMENT));
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if ((size_type {1} << class_idx) > m_region_size) {
+        auto iter = std::find_if(m_regions.begin(), m_regions.end(),
+                                 [p](const Region& region) { return region.data == p; });
+        ASSERT(iter != m_regions.end());
+        unmap_region(*iter);
+        m_regions.erase(iter);
+        return;
+    }
+
+    m_free_lists[class_idx] = ::new(p) FreeBlock {m_free_lists[class_idx]};
+}
+
+const char* HugePageAllocator::mode_name(Mode mode)
+{
+    switch (mode) {
+    case Mode::HUGETLB:     return "hugetlb";
+    case Mode::TRANSPARENT: return "transparent";
+    case Mode::NONE:        return "none";
+    }
+
+    return "unknown";
+}
+
+#if defined(__linux__)
+void* HugePageAllocator::map_region(size_type size)
+{
+    const auto map_size = static_cast<size_t>(round_up(size, HUGE_PAGE_SIZE));
+
+    if (!m_hugetlb_failed) {
+        auto p = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            m_mode.store(Mode::HUGETLB, std::memory_order_relaxed);
+            return p;
+        }
+        m_hugetlb_failed = true;
+    }
+
+    // Over-map by one huge page so that the region can start on a huge page boundary, THP only backs aligned ranges
+    const auto over_size = map_size + static_cast<size_t>(HUGE_PAGE_SIZE);
+    auto raw = static_cast<char*>(mmap(nullptr, over_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (raw == MAP_FAILED) {
+        return nullptr;
+    }
+
+    const auto mask = static_cast<std::uintptr_t>(HUGE_PAGE_SIZE - 1);
+    auto p = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(raw) + mask) & ~mask);
+    if (p != raw) {
+        munmap(raw, static_cast<size_t>(p - raw));
+    }
+    if (p + map_size != raw + over_size) {
+        munmap(p + map_size, static_cast<size_t>((raw + over_size) - (p + map_size)));
+    }
+
+    const auto advised = madvise(p, map_size, MADV_HUGEPAGE) == 0;
+    m_mode.store(advised ? Mode::TRANSPARENT : Mode::NONE, std::memory_order_relaxed);
+
+    return p;
+}
+
+void HugePageAllocator::unmap_region(const Region& region)
+{
+    munmap(region.data, static_cast<size_t>(region.size));
+}
+#else
+// No huge page support on this platform, regions are plain page aligned memory
+void* HugePageAllocator::map_region(size_type size)
+{
+    m_mode.store(Mode::NONE, std::memory_order_relaxed);
+    return boost::alignment::aligned_alloc(static_cast<size_t>(HUGE_PAGE_SIZE),
+                                           static_cast<size_t>(round_up(size, HUGE_PAGE_SIZE)));
+}
+
+void HugePageAllocator::unmap_region(const Region& region)
+{
+    boost::alignment::aligned_free(region.data);
+}
+#endif
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// MmapFileAllocator
+constexpr size_type MmapFileAllocator::DEFAULT_CAPACITY;
+constexpr size_type MmapFileAllocator::GROW_SIZE;
+constexpr size_type MmapFileAllocator::MAX_BLOCK_ALIGNMENT;
+constexpr size_type MmapFileAllocator::NUM_CLASSES;
+
+namespace {
+constexpr std::uint64_t MMAP_FILE_MAGIC   = 0x454c4946'50414d4d; // "MMAPFILE"
+constexpr std::uint32_t MMAP_FILE_VERSION = 1;
+
+// Blocks start after the header on a page boundary
+constexpr size_type MMAP_FILE_HEADER_SIZE = 1 << 12;
+}
+
+void* MmapFileAllocator::allocate(size_type n)
+{
+    return MmapFileAllocator::allocate(n, MIN_ALIGNMENT);
+}
+
+void* MmapFileAllocator::allocate(size_type n, size_type alignment)
+{
+    const auto class_idx = log2_ceil(std::max(n, MIN_ALIGNMENT));
+    const auto block_size = size_type {1} << class_idx;
+
+    // Blocks are aligned to their class size, up to MAX_BLOCK_ALIGNMENT
+    const auto block_alignment = std::min(block_size, MAX_BLOCK_ALIGNMENT);
+    if (alignment > block_alignment || class_idx >= NUM_CLASSES) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    auto& hdr = header();
+    if (const auto offset = hdr.free_lists[class_idx]) {
+        hdr.free_lists[class_idx] = *reinterpret_cast<std::uint64_t*>(m_base + offset);
+        return m_base + offset;
+    }
+
+    const auto offset = round_up(static_cast<size_type>(hdr.top), block_alignment);
+    if (offset + block_size > static_cast<size_type>(hdr.size) && !grow(offset + block_size)) {
+        return nullptr;
+    }
+
+    hdr.top = static_cast<std::uint64_t>(offset + block_size);
+    return m_base + offset;
+}
+
+void MmapFileAllocator::deallocate(void* p, size_type n)
+{
+    if (p == nullptr) {
+        return;
+    }
+
+    const auto class_idx = log2_ceil(std::max(n, MIN_ALIGNMENT));
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    auto& hdr = header();
+    *static_cast<std::uint64_t*>(p) = hdr.free_lists[class_idx];
+    hdr.free_lists[class_idx] = static_cast<std::uint64_t>(offset_of(p));
+}
+
+void* MmapFileAllocator::root() const
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    const auto offset = header().root;
+    return offset != 0 ? m_base + offset : nullptr;
+}
+
+void MmapFileAllocator::set_root(void* p)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    header().root = p != nullptr ? static_cast<std::uint64_t>(offset_of(p)) : 0;
+}
+
+size_type MmapFileAllocator::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return static_cast<size_type>(header().size);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+MmapFileAllocator::MmapFileAllocator(const std::string& path, size_type capacity)
+{
+    m_fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (m_fd < 0) {
+        throw std::runtime_error("Can't open " + path);
+    }
+
+    auto fail = [this](const std::string& msg) {
+        if (m_base != nullptr) {
+            munmap(m_base, static_cast<size_t>(m_capacity));
+        }
+        close(m_fd);
+        throw std::runtime_error(msg);
+    };
+
+    struct stat file_stat {};
+    if (fstat(m_fd, &file_stat) != 0) {
+        fail("Can't stat " + path);
+    }
+
+    // An existing file tells where it was mapped before and how much of it is in use
+    const auto is_new = file_stat.st_size == 0;
+    Header file_header {};
+    if (!is_new) {
+        if (pread(m_fd, &file_header, sizeof(file_header), 0) != static_cast<ssize_t>(sizeof(file_header)) ||
+            file_header.magic != MMAP_FILE_MAGIC || file_header.version != MMAP_FILE_VERSION ||
+            file_header.size > static_cast<std::uint64_t>(file_stat.st_size)) {
+            fail(path + " is not a file written by MmapFileAllocator");
+        }
+        capacity = std::max(capacity, static_cast<size_type>(file_header.size));
+    }
+    m_capacity = round_up(capacity, GROW_SIZE);
+
+    // Reserve the whole capacity so the mapping can grow in place
+    auto hint = is_new ? nullptr : reinterpret_cast<void*>(static_cast<std::uintptr_t>(file_header.base_address));
+    auto base = mmap(hint, static_cast<size_t>(m_capacity), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                     -1, 0);
+    if (base == MAP_FAILED) {
+        fail("Can't reserve address space for " + path);
+    }
+    m_base = static_cast<char*>(base);
+    m_same_address = is_new || base == hint;
+
+    const auto map_size = is_new ? GROW_SIZE : static_cast<size_type>(file_header.size);
+    if (is_new && ftruncate(m_fd, static_cast<off_t>(map_size)) != 0) {
+        fail("Can't resize " + path);
+    }
+    if (mmap(m_base, static_cast<size_t>(map_size), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, m_fd, 0) ==
+        MAP_FAILED) {
+        fail("Can't map " + path);
+    }
+
+    if (is_new) {
+        auto& hdr = *::new(static_cast<void*>(m_base)) Header {};
+        hdr.magic = MMAP_FILE_MAGIC;
+        hdr.version = MMAP_FILE_VERSION;
+        hdr.size = static_cast<std::uint64_t>(map_size);
+        hdr.top = static_cast<std::uint64_t>(MMAP_FILE_HEADER_SIZE);
+    }
+    header().base_address = reinterpret_cast<std::uintptr_t>(m_base);
+}
+
+MmapFileAllocator::~MmapFileAllocator()
+{
+    munmap(m_base, static_cast<size_t>(m_capacity));
+    close(m_fd);
+}
+
+bool MmapFileAllocator::grow(size_type size)
+{
+    const auto old_size = static_cast<size_type>(header().size);
+    const auto new_size = std::min(std::max(round_up(size, GROW_SIZE), 2 * old_size), m_capacity);
+    if (new_size < size) {
+        return false;
+    }
+
+    if (ftruncate(m_fd, static_cast<off_t>(new_size)) != 0) {
+        return false;
+    }
+
+    if (mmap(m_base + old_size, static_cast<size_t>(new_size - old_size), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, m_fd, static_cast<off_t>(old_size)) == MAP_FAILED) {
+        return false;
+    }
+
+    header().size = static_cast<std::uint64_t>(new_size);
+    return true;
+}
+
+// The mapping only grows, so the pages up to the size read under the lock stay valid while msync runs
+void MmapFileAllocator::sync()
+{
+    msync(m_base, static_cast<size_t>(size()), MS_SYNC);
+}
+#else
+MmapFileAllocator::MmapFileAllocator(const std::string&, size_type)
+{
+    throw std::runtime_error("MmapFileAllocator is not supported on this platform");
+}
+
+MmapFileAllocator::~MmapFileAllocator() = default;
+
+bool MmapFileAllocator::grow(size_type)
+{
+    return false;
+}
+
+void MmapFileAllocator::sync()
+{
+}
+#endif
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// StatsAllocator
+constexpr size_type AllocStats::NUM_SIZE_BUCKETS;
+constexpr size_type StatsAllocator::NUM_THREAD_SLOTS;
+
+namespace {
+std::atomic<size_type> g_next_thread_slot {0};
+thread_local size_type t_thread_slot = -1;
+}
+
+void AllocStats::report(std::ostream& os) const
+{
+    os << "allocations:     " << num_allocs << "\n"
+       << "deallocations:   " << num_deallocs << "\n"
+       << "bytes allocated: " << bytes_allocated << "\n"
+       << "bytes freed:     " << bytes_freed << "\n"
+       << "bytes live:      " << bytes_live << "\n"
+       << "peak bytes live: " << peak_bytes_live << "\n"
+       << "size histogram:\n";
+
+    for (size_type i = 0; i < NUM_SIZE_BUCKETS; ++i) {
+        if (size_histogram[i] != 0) {
+            os << "  <= " << (size_type {1} << i) << (i + 1 == NUM_SIZE_BUCKETS ? "+" : "") << ": "
+               << size_histogram[i] << "\n";
+        }
+    }
+}
+
+void* StatsAllocator::allocate(size_type n)
+{
+    auto p = m_upstream.allocate(n);
+    if (p != nullptr) {
+        record_allocate(1, n);
+    }
+
+    return p;
+}
+
+void* StatsAllocator::allocate(size_type n, size_type alignment)
+{
+    auto p = m_upstream.allocate(n, alignment);
+    if (p != nullptr) {
+        record_allocate(1, n);
+    }
+
+    return p;
+}
+
+void StatsAllocator::deallocate(void* p, size_type n)
+{
+    if (p != nullptr) {
+        record_deallocate(1, n);
+    }
+
+    m_upstream.deallocate(p, n);
+}
+
+// An expanded block is counted as freed with its old size and allocated with its new size
+bool StatsAllocator::try_expand(void* p, size_type old_n, size_type new_n)
+{
+    if (!m_upstream.try_expand(p, old_n, new_n)) {
+        return false;
+    }
+
+    record_deallocate(1, old_n);
+    record_allocate(1, new_n);
+
+    return true;
+}
+
+size_type StatsAllocator::allocate_bulk(size_type count, size_type n, size_type alignment, void** out)
+{
+    const auto num_allocated = m_upstream.allocate_bulk(count, n, alignment, out);
+    record_allocate(num_allocated, n);
+
+    return num_allocated;
+}
+
+void StatsAllocator::deallocate_bulk(size_type count, size_type n, void* const* ptrs)
+{
+    record_deallocate(std::count_if(ptrs, ptrs + count, [](void* p) { return p != nullptr; }), n);
+    m_upstream.deallocate_bulk(count, n, ptrs);
+}
+
+void StatsAllocator::record_allocate(size_type count, size_type n)
+{
+    auto& slot = thread_slot();
+    slot.num_allocs.fetch_add(count, std::memory_order_relaxed);
+    slot.bytes_allocated.fetch_add(count * n, std::memory_order_relaxed);
+
+    const auto bucket = std::min(log2_ceil(n), AllocStats::NUM_SIZE_BUCKETS - 1);
+    slot.size_histogram[bucket].fetch_add(count, std::memory_order_relaxed);
+
+    // Only sum up all slots when this thread's live bytes reach a new high, slots with blocks freed by other threads
+    // can go negative
+    const auto slot_live = slot.bytes_allocated.load(std::memory_order_relaxed) -
+                           slot.bytes_freed.load(std::memory_order_relaxed);
+    if (slot_live <= slot.peak_bytes_live.load(std::memory_order_relaxed)) {
+        return;
+    }
+    slot.peak_bytes_live.store(slot_live, std::memory_order_relaxed);
+
+    size_type live = 0;
+    for (const auto& s : m_slots) {
+        live += s.bytes_allocated.load(std::memory_order_relaxed) - s.bytes_freed.load(std::memory_order_relaxed);
+    }
+
+    auto peak = m_peak_bytes_live.load(std::memory_order_relaxed);
+    while (live > peak && !m_peak_bytes_live.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+void StatsAllocator::record_deallocate(size_type count, size_type n)
+{
+    auto& slot = thread_slot();
+    slot.num_deallocs.fetch_add(count, std::memory_order_relaxed);
+    slot.bytes_freed.fetch_add(count * n, std::memory_order_relaxed);
+}
+
+StatsAllocator::ThreadSlot& StatsAllocator::thread_slot()
+{
+    if (t_thread_slot < 0) {
+        t_thread_slot = g_next_thread_slot.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return m_slots[t_thread_slot % NUM_THREAD_SLOTS];
+}
+
+void StatsAllocator::ThreadSlot::add_to(AllocStats& stats) const
+{
+    const auto allocated = bytes_allocated.load(std::memory_order_relaxed);
+    const auto freed = bytes_freed.load(std::memory_order_relaxed);
+
+    stats.num_allocs += num_allocs.load(std::memory_order_relaxed);
+    stats.num_deallocs += num_deallocs.load(std::memory_order_relaxed);
+    stats.bytes_allocated += allocated;
+    stats.bytes_freed += freed;
+    stats.bytes_live += allocated - freed;
+
+    for (size_type i = 0; i < AllocStats::NUM_SIZE_BUCKETS; ++i) {
+        stats.size_histogram[i] += size_histogram[i].load(std::memory_order_relaxed);
+    }
+}
+
+AllocStats StatsAllocator::snapshot() const
+{
+    AllocStats stats;
+    for (const auto& slot : m_slots) {
+        slot.add_to(stats);
+    }
+    stats.peak_bytes_live = m_peak_bytes_live.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
+std::vector<AllocStats> StatsAllocator::thread_snapshots() const
+{
+    const auto num_slots = std::min(g_next_thread_slot.load(std::memory_order_relaxed), NUM_THREAD_SLOTS);
+
+    std::vector<AllocStats> stats(static_cast<size_t>(num_slots));
+    for (size_type i = 0; i < num_slots; ++i) {
+        m_slots[i].add_to(stats[i]);
+    }
+
+    return stats;
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// TracingAllocator
+constexpr std::uint64_t AllocTraceHeader::MAGIC;
+constexpr std::uint32_t AllocTraceHeader::VERSION;
+constexpr size_type TracingAllocator::BUFFER_SIZE;
+
+namespace {
+std::atomic<std::uint32_t> g_next_trace_thread {0};
+thread_local std::int64_t t_trace_thread = -1;
+}
+
+std::vector<AllocTraceRecord> read_alloc_trace(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Can't open allocation trace " + path);
+    }
+
+    AllocTraceHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || header.magic != AllocTraceHeader::MAGIC || header.version != AllocTraceHeader::VERSION ||
+        header.record_size != sizeof(AllocTraceRecord)) {
+        throw std::runtime_error(path + " is not an allocation trace");
+    }
+
+    std::vector<AllocTraceRecord> records;
+    AllocTraceRecord record;
+    while (file.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+        records.push_back(record);
+    }
+
+    return records;
+}
+
+TracingAllocator::TracingAllocator(Allocator& upstream, const std::string& path)
+    : m_upstream {upstream},
+      m_file {path, std::ios::binary | std::ios::trunc},
+      m_start {std::chrono::steady_clock::now()}
+{
+    if (!m_file) {
+        throw std::runtime_error("Can't create allocation trace " + path);
+    }
+
+    const AllocTraceHeader header;
+    m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    m_buffer.reserve(static_cast<size_t>(BUFFER_SIZE));
+}
+
+TracingAllocator::~TracingAllocator()
+{
+    flush();
+}
+
+void* TracingAllocator::allocate(size_type n)
+{
+    auto p = m_upstream.allocate(n);
+    if (p != nullptr) {
+        record(AllocTraceRecord::ALLOCATE, p, n, 0);
+    }
+
+    return p;
+}
+
+void* TracingAllocator::allocate(size_type n, size_type alignment)
+{
+    auto p = m_upstream.allocate(n, alignment);
+    if (p != nullptr) {
+        record(AllocTraceRecord::ALLOCATE, p, n, alignment);
+    }
+
+    return p;
+}
+
+// Frees are logged before the block is released, so another thread reusing it is always logged after the free
+void TracingAllocator::deallocate(void* p, size_type n)
+{
+    if (p != nullptr) {
+        record(AllocTraceRecord::DEALLOCATE, p, n, 0);
+    }
+
+    m_upstream.deallocate(p, n);
+}
+
+bool TracingAllocator::try_expand(void* p, size_type old_n, size_type new_n)
+{
+    if (!m_upstream.try_expand(p, old_n, new_n)) {
+        return false;
+    }
+
+    record(AllocTraceRecord::EXPAND, p, new_n, 0);
+
+    return true;
+}
+
+size_type TracingAllocator::allocate_bulk(size_type count, size_type n, size_type alignment, void** out)
+{
+    const auto num_allocated = m_upstream.allocate_bulk(count, n, alignment, out);
+    for (size_type i = 0; i < num_allocated; ++i) {
+        record(AllocTraceRecord::ALLOCATE, out[i], n, alignment);
+    }
+
+    return num_allocated;
+}
+
+void TracingAllocator::deallocate_bulk(size_type count, size_type n, void* const* ptrs)
+{
+    for (size_type i = 0; i < count; ++i) {
+        if (ptrs[i] != nullptr) {
+            record(AllocTraceRecord::DEALLOCATE, ptrs[i], n, 0);
+        }
+    }
+
+    m_upstream.deallocate_bulk(count, n, ptrs);
+}
+
+void TracingAllocator::flush()
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    flush_locked();
+    m_file.flush();
+}
+
+void TracingAllocator::record(AllocTraceRecord::Op op, const void* p, size_type n, size_type alignment)
+{
+    if (t_trace_thread < 0) {
+        t_trace_thread = g_next_trace_thread.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    AllocTraceRecord record {};
+    record.address = reinterpret_cast<std::uintptr_t>(p);
+    record.size = static_cast<std::uint64_t>(n);
+    record.thread = static_cast<std::uint32_t>(t_trace_thread);
+    record.alignment_log2 = static_cast<std::uint8_t>(alignment > 0 ? log2_ceil(alignment) : 0);
+    record.op = op;
+
+    // Timestamp is taken under the lock so the file is in timestamp order
+    std::lock_guard<std::mutex> lock(m_mtx);
+    record.timestamp = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count());
+    m_buffer.push_back(record);
+    if (static_cast<size_type>(m_buffer.size()) >= BUFFER_SIZE) {
+        flush_locked();
+    }
 }
 
-void DefaultAllocator::deallocate(void* p, size_type)
+void TracingAllocator::flush_locked()
 {
-    boost::alignment::aligned_free(p);
+    m_file.write(reinterpret_cast<const char*>(m_buffer.data()),
+                 static_cast<std::streamsize>(m_buffer.size() * sizeof(AllocTraceRecord)));
+    m_buffer.clear();
 }
 CLS_END
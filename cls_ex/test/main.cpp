@@ -22,11 +22,35 @@
 // SOFTWARE.
 /////////////////////////////////////////////////////////////////////////////////
 
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <deque>
 #include <boost/container/small_vector.hpp>
+#include <cls/algorithm.hpp>
 #include <cls_ex/deque_x.h>
+#include <cls_ex/ring_deque.h>
+#include <cls_ex/spsc_deque.h>
+#include <cls_ex/work_stealing_deque.h>
+
+// Path of a scratch file in $TMPDIR, or /tmp if it isn't set
+std::string temp_path(const char* name)
+{
+    const char* tmp_dir = std::getenv("TMPDIR");
+    return std::string {tmp_dir != nullptr ? tmp_dir : "/tmp"} + "/" + name;
+}
 
 void performance_test()
 {
@@ -72,9 +96,1465 @@ void performance_test()
     printf("Standard %f\n", (double(end - start) / 1000));
 }
 
+// Allocate and free blocks the way Deque does: fixed SubarrayT sized blocks, FIFO order
+template <typename T, cls::size_type SIZE = cls::detail::DEFAULT_SUBARRAY_SIZE<T>>
+double subarray_alloc_test()
+{
+    using Subarray = cls::detail::SubarrayT<T, SIZE>;
+    constexpr int num_rounds = 200;
+    constexpr int num_live   = 1000;
+
+    std::vector<T*> blocks(num_live);
+
+    clock_t start = clock();
+    for (int round = 0; round < num_rounds; ++round) {
+        for (auto& block : blocks) {
+            block = Subarray::allocate();
+        }
+        for (auto& block : blocks) {
+            Subarray::deallocate(block);
+        }
+    }
+    clock_t end = clock();
+
+    return double(end - start) / 1000;
+}
+
+// Deque used as a FIFO queue, subarrays are freed at front and allocated at back all the time
+template <typename DequeT = cls::Deque<int>>
+double deque_fifo_test()
+{
+    DequeT queue;
+
+    clock_t start = clock();
+    for (int i = 0; i < 1e7; ++i) {
+        queue.push_back(i);
+        if (queue.size() > 10000) {
+            queue.pop_front();
+        }
+    }
+    clock_t end = clock();
+
+    return double(end - start) / 1000;
+}
+
+// FIFO queue of a steady size, count the subarrays it allocates once it is full
+void spare_subarray_test(cls::size_type spare_limit)
+{
+    cls::DefaultAllocator upstream;
+    cls::StatsAllocator stats_alloc {upstream};
+    cls::ScopedActiveAllocator scope {stats_alloc};
+
+    cls::Deque<int> queue;
+    queue.set_spare_limit(spare_limit);
+    for (int i = 0; i < 10000; ++i) {
+        queue.push_back(i);
+    }
+    const auto num_allocs = stats_alloc.snapshot().num_allocs;
+
+    clock_t start = clock();
+    for (int i = 0; i < 1e7; ++i) {
+        queue.push_back(i);
+        queue.pop_front();
+    }
+    clock_t end = clock();
+
+    printf("%-18s fifo %f, spare limit %td, %td allocations\n", "Deque", double(end - start) / 1000, spare_limit,
+           stats_alloc.snapshot().num_allocs - num_allocs);
+}
+
+// Many short-lived containers which are dropped together
+double short_lived_test(cls::ArenaAllocator* arena)
+{
+    clock_t start = clock();
+    for (int round = 0; round < 1000; ++round) {
+        {
+            std::vector<cls::Deque<int>> deques(100);
+            for (auto& deque : deques) {
+                for (int i = 0; i < 1000; ++i) {
+                    deque.push_back(i);
+                }
+            }
+        }
+        if (arena != nullptr) {
+            arena->reset();
+        }
+    }
+    clock_t end = clock();
+
+    return double(end - start) / 1000;
+}
+
+// One thread allocates blocks and hands them over to another thread which frees them, return wall time in ms
+double cross_thread_free_test(cls::Allocator& alloc, cls::size_type block_size)
+{
+    constexpr int num_blocks = 2000000;
+    constexpr int ring_size  = 1024;
+
+    std::array<std::atomic<void*>, ring_size> ring {};
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread producer([&] {
+        for (int i = 0; i < num_blocks; ++i) {
+            auto p = alloc.allocate(block_size);
+            auto& slot = ring[i % ring_size];
+            while (slot.load(std::memory_order_acquire) != nullptr) {
+                std::this_thread::yield();
+            }
+            slot.store(p, std::memory_order_release);
+        }
+    });
+
+    std::thread consumer([&] {
+        for (int i = 0; i < num_blocks; ++i) {
+            auto& slot = ring[i % ring_size];
+            void* p = nullptr;
+            while ((p = slot.load(std::memory_order_acquire)) == nullptr) {
+                std::this_thread::yield();
+            }
+            slot.store(nullptr, std::memory_order_release);
+            alloc.deallocate(p, block_size);
+        }
+    });
+
+    producer.join();
+    consumer.join();
+
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Messages passed from one thread to another through a mutex guarded Deque, or a SpscDeque one message or one batch
+// at a time, abort if a message is lost or out of order. Return wall time in ms
+enum class Channel {LOCKED, SPSC, SPSC_BATCH};
+
+double message_passing_test(Channel channel)
+{
+    constexpr int num_messages = 10000000;
+    constexpr int batch_size   = 64;
+
+    std::mutex mtx;
+    cls::Deque<int> locked_queue;
+    cls::SpscDeque<int> spsc_queue;
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread producer([&] {
+        std::array<int, batch_size> batch;
+        for (int i = 0; i < num_messages; i += batch_size) {
+            for (int j = 0; j < batch_size; ++j) {
+                batch[j] = i + j;
+            }
+
+            if (channel == Channel::LOCKED) {
+                for (auto msg : batch) {
+                    std::lock_guard<std::mutex> lock {mtx};
+                    locked_queue.push_back(msg);
+                }
+            } else if (channel == Channel::SPSC) {
+                for (auto msg : batch) {
+                    spsc_queue.push(msg);
+                }
+            } else {
+                spsc_queue.push_n(batch.begin(), batch_size);
+            }
+        }
+    });
+
+    // Messages have to arrive in the order they were sent
+    int expected = 0;
+    std::array<int, batch_size> batch;
+    while (expected < num_messages) {
+        cls::size_type n = 0;
+        if (channel == Channel::LOCKED) {
+            std::lock_guard<std::mutex> lock {mtx};
+            if (!locked_queue.empty()) {
+                batch[n++] = locked_queue.front();
+                locked_queue.pop_front();
+            }
+        } else if (channel == Channel::SPSC) {
+            n = spsc_queue.try_pop(batch[0]) ? 1 : 0;
+        } else {
+            n = spsc_queue.pop_n(batch.begin(), batch_size);
+        }
+
+        for (cls::size_type i = 0; i < n; ++i, ++expected) {
+            if (batch[i] != expected) {
+                fprintf(stderr, "message_passing_test: received %d, expected %d\n", batch[i], expected);
+                std::abort();
+            }
+        }
+    }
+
+    producer.join();
+    const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    return elapsed;
+}
+
+// SpscDeque with small subarrays, so batches straddle subarrays and blocks are recycled all the time. Single and
+// batched pushes and pops are mixed at random. The strings are too long for the small string buffer, so elements
+// destroyed twice or never show up in leak checkers. Abort on the first message lost or out of order, return wall
+// time in ms
+double spsc_stress_test()
+{
+    constexpr int num_messages = 1000000;
+    constexpr int max_batch    = 19;
+
+    using QueueT = cls::SpscDeque<std::string, 8>;
+    auto message = [](int i) { return "message number " + std::to_string(i); };
+    auto check = [](const char* what, bool ok) {
+        if (!ok) {
+            fprintf(stderr, "spsc_stress_test: %s\n", what);
+            std::abort();
+        }
+    };
+
+    QueueT queue;
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread producer([&] {
+        std::mt19937 rng {1};
+        std::vector<std::string> batch;
+        for (int i = 0; i < num_messages;) {
+            switch (rng() % 4) {
+            case 0: {
+                const auto msg = message(i++);
+                queue.push(msg);
+                break;
+            }
+            case 1:
+                queue.push(message(i++));
+                break;
+            case 2:
+                queue.emplace(message(i++));
+                break;
+            default:
+                batch.clear();
+                for (auto n = std::min<int>(1 + rng() % max_batch, num_messages - i); n > 0; --n) {
+                    batch.push_back(message(i++));
+                }
+                queue.push_n(batch.begin(), static_cast<cls::size_type>(batch.size()));
+            }
+        }
+    });
+
+    std::mt19937 rng {2};
+    std::array<std::string, max_batch> batch;
+    for (int expected = 0; expected < num_messages;) {
+        cls::size_type n = 0;
+        if (rng() % 2 == 0) {
+            n = queue.try_pop(batch[0]) ? 1 : 0;
+        } else {
+            n = queue.pop_n(batch.begin(), 1 + rng() % max_batch);
+        }
+
+        for (cls::size_type i = 0; i < n; ++i, ++expected) {
+            if (batch[i] != message(expected)) {
+                fprintf(stderr, "spsc_stress_test: received \"%s\", expected \"%s\"\n", batch[i].c_str(),
+                        message(expected).c_str());
+                std::abort();
+            }
+        }
+    }
+
+    producer.join();
+    const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    check("queue not empty after all messages were received", queue.empty());
+
+    // Elements still queued are destroyed with the queue
+    auto token = std::make_shared<int>(0);
+    {
+        cls::SpscDeque<std::shared_ptr<int>, 8> token_queue;
+        for (int i = 0; i < 20; ++i) {
+            token_queue.push(token);
+        }
+        std::shared_ptr<int> value;
+        for (int i = 0; i < 5; ++i) {
+            token_queue.try_pop(value);
+        }
+    }
+    check("elements left in the queue were not destroyed", token.use_count() == 1);
+
+    // A queue of steady size stops allocating once it has enough blocks
+    {
+        cls::DefaultAllocator upstream;
+        cls::StatsAllocator stats_alloc {upstream};
+        cls::ScopedActiveAllocator scope {stats_alloc};
+
+        QueueT steady_queue;
+        std::string value;
+        auto round = [&](int i) {
+            for (int j = 0; j < 5; ++j) {
+                steady_queue.push(message(i + j));
+            }
+            for (int j = 0; j < 5; ++j) {
+                steady_queue.try_pop(value);
+            }
+        };
+
+        for (int i = 0; i < 10; ++i) {
+            round(i);
+        }
+        const auto num_allocs = stats_alloc.snapshot().num_allocs;
+        for (int i = 0; i < 1000; ++i) {
+            round(i);
+        }
+        check("blocks were not recycled", stats_alloc.snapshot().num_allocs == num_allocs);
+    }
+
+    return elapsed;
+}
+
+// Deque guarded by a mutex, with the interface of WorkStealingDeque
+class LockedDeque {
+public:
+    explicit LockedDeque(cls::size_type) {}
+
+    void push(int value)
+    {
+        std::lock_guard<std::mutex> lock {m_mtx};
+        m_deque.push_back(value);
+    }
+
+    bool pop(int& value)
+    {
+        std::lock_guard<std::mutex> lock {m_mtx};
+        return take(value, m_deque.back(), [this] { m_deque.pop_back(); });
+    }
+
+    bool steal(int& value)
+    {
+        std::lock_guard<std::mutex> lock {m_mtx};
+        return take(value, m_deque.front(), [this] { m_deque.pop_front(); });
+    }
+
+private:
+    template <typename Remove>
+    bool take(int& value, const int& end, Remove remove)
+    {
+        if (m_deque.empty()) {
+            return false;
+        }
+
+        value = end;
+        remove();
+        return true;
+    }
+
+    std::mutex m_mtx;
+    cls::Deque<int> m_deque;
+};
+
+// Tasks pushed by an owner thread, which pops some of them back while num_thieves threads steal the others. The deque
+// starts small so it grows while thieves are reading it. Every task has to be taken exactly once, abort otherwise.
+// Return wall time in ms
+template <typename DequeT = cls::WorkStealingDeque<int>>
+double work_stealing_test(int num_thieves)
+{
+    constexpr int num_tasks = 4000000;
+
+    DequeT deque {16};
+    std::unique_ptr<std::atomic<char>[]> taken {new std::atomic<char>[num_tasks]};
+    std::for_each(taken.get(), taken.get() + num_tasks, [](std::atomic<char>& t) { t.store(0); });
+    auto run_task = [&](int task) { taken[task].fetch_add(1, std::memory_order_relaxed); };
+
+    // Set once the owner has emptied the deque, so thieves stop even if a task went missing
+    std::atomic<bool> done {false};
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> thieves;
+    for (int i = 0; i < num_thieves; ++i) {
+        thieves.emplace_back([&] {
+            int task;
+            while (!done.load(std::memory_order_acquire)) {
+                if (deque.steal(task)) {
+                    run_task(task);
+                }
+            }
+        });
+    }
+
+    int task;
+    for (int i = 0; i < num_tasks; ++i) {
+        deque.push(i);
+        if (i % 4 == 0 && deque.pop(task)) {
+            run_task(task);
+        }
+    }
+    while (deque.pop(task)) {
+        run_task(task);
+    }
+    done.store(true, std::memory_order_release);
+    for (auto& thief : thieves) {
+        thief.join();
+    }
+    const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    for (int i = 0; i < num_tasks; ++i) {
+        if (taken[i].load() != 1) {
+            fprintf(stderr, "work_stealing_test: task %d taken %d times\n", i, taken[i].load());
+            std::abort();
+        }
+    }
+
+    return elapsed;
+}
+
+// Random operator[] on a large container, dominated by TLB misses
+template <typename Container = cls::Deque<int>>
+double random_access_test()
+{
+    constexpr int num_elements = 1 << 24;
+    constexpr int num_reads    = 10000000;
+
+    Container deque;
+    for (int i = 0; i < num_elements; ++i) {
+        deque.push_back(i);
+    }
+
+    std::mt19937 rng;
+    std::uniform_int_distribution<int> dist(0, num_elements - 1);
+    std::vector<int> indices(num_reads);
+    for (auto& idx : indices) {
+        idx = dist(rng);
+    }
+
+    long long sum = 0;
+    clock_t start = clock();
+    for (auto idx : indices) {
+        sum += deque[idx];
+    }
+    clock_t end = clock();
+
+    // Every element holds its index
+    if (sum != std::accumulate(indices.begin(), indices.end(), 0LL)) {
+        fprintf(stderr, "random_access_test: wrong sum of elements read\n");
+        std::abort();
+    }
+
+    return double(end - start) / 1000;
+}
+
+// operator[] and at() against iterators, with begin() at every offset in its subarray. The index arithmetic only
+// differs from the iterators' when begin() is not at the start of a subarray. Abort on the first mismatch
+template <cls::size_type SUBARRAY_SIZE>
+void element_access_test()
+{
+    cls::Deque<int, SUBARRAY_SIZE> deque;
+    for (int i = 0; i < 5 * SUBARRAY_SIZE; ++i) {
+        deque.push_back(i);
+    }
+
+    for (int round = 0; round < 3 * SUBARRAY_SIZE; ++round) {
+        // Shift begin() by one, alternately back and forth across subarray boundaries
+        if (round % 3 == 2) {
+            deque.push_front(-round);
+        } else {
+            deque.pop_front();
+            deque.push_back(round);
+        }
+
+        const auto& const_deque = deque;
+        for (cls::size_type i = 0; i < deque.size(); ++i) {
+            const auto& expected = *(deque.begin() + i);
+            if (&deque[i] != &expected || &deque.at(i) != &expected || &const_deque[i] != &expected ||
+                deque[i] != *std::next(const_deque.cbegin(), i)) {
+                fprintf(stderr, "element_access_test<%td>: element %td differs from begin() + %td\n", SUBARRAY_SIZE,
+                        i, i);
+                std::abort();
+            }
+        }
+    }
+}
+
+// Sum a large Deque several times, through its iterators or one segment at a time
+double iteration_test(bool segmented)
+{
+    constexpr int num_elements = 1 << 24;
+    constexpr int num_rounds   = 10;
+
+    cls::Deque<int> deque;
+    for (int i = 0; i < num_elements; ++i) {
+        deque.push_back(i);
+    }
+
+    long long sum = 0;
+    clock_t start = clock();
+    for (int round = 0; round < num_rounds; ++round) {
+        if (segmented) {
+            sum += cls::accumulate(deque, 0LL, std::plus<>{});
+        } else {
+            for (auto it = deque.begin(); it != deque.end(); ++it) {
+                sum += *it;
+            }
+        }
+    }
+    clock_t end = clock();
+
+    return sum > 0 ? double(end - start) / 1000 : 0;
+}
+
+// Records ingested in batches, with one push_back per record or one append per batch
+double ingest_test(bool bulk)
+{
+    struct Record {
+        long long timestamp;
+        double value;
+    };
+    constexpr int batch_size  = 4096;
+    constexpr int num_batches = 5000;
+
+    std::vector<Record> batch(batch_size);
+    for (int i = 0; i < batch_size; ++i) {
+        batch[i] = {i, i * 0.5};
+    }
+
+    cls::Deque<Record> deque;
+    clock_t start = clock();
+    for (int i = 0; i < num_batches; ++i) {
+        if (bulk) {
+            deque.append(batch);
+        } else {
+            for (const auto& record : batch) {
+                deque.push_back(record);
+            }
+        }
+        if (deque.size() > 1 << 20) {
+            deque.clear();
+        }
+    }
+    clock_t end = clock();
+
+    // Both ways leave whole batches in order
+    for (cls::size_type i = 0; i < deque.size(); ++i) {
+        if (deque[i].timestamp != i % batch_size || deque[i].value != (i % batch_size) * 0.5) {
+            fprintf(stderr, "ingest_test(%d): record %td is wrong\n", int(bulk), i);
+            std::abort();
+        }
+    }
+
+    return double(end - start) / 1000;
+}
+
+// append, prepend and insert at either end against std::deque, from spans and from list iterators, for sizes around
+// a subarray and with begin() at every offset in its subarray. Abort on the first mismatch
+template <typename T, cls::size_type SUBARRAY_SIZE, typename Make>
+void append_prepend_test(const char* name, Make make)
+{
+    using DequeT = cls::Deque<T, SUBARRAY_SIZE>;
+
+    auto verify = [name](const DequeT& deque, const std::deque<T>& expected, const char* op, int offset, int n) {
+        if (deque.size() != static_cast<cls::size_type>(expected.size()) ||
+            !std::equal(expected.begin(), expected.end(), deque.begin()) ||
+            !std::equal(expected.rbegin(), expected.rend(), deque.rbegin())) {
+            fprintf(stderr, "append_prepend_test<%s>: %s of %d elements at offset %d differs from std::deque\n",
+                    name, op, n, offset);
+            std::abort();
+        }
+    };
+
+    const int sizes[] = {0, 1, int(SUBARRAY_SIZE) - 1, int(SUBARRAY_SIZE), int(SUBARRAY_SIZE) + 1};
+    int counter = 0;
+    for (int offset = 0; offset <= SUBARRAY_SIZE; ++offset) {
+        for (auto n : sizes) {
+            std::vector<T> source;
+            for (int i = 0; i < n; ++i) {
+                source.push_back(make(counter++));
+            }
+            const std::list<T> list_source {source.begin(), source.end()};
+
+            DequeT deque;
+            std::deque<T> expected;
+            for (int i = 0; i < offset; ++i) {
+                auto value = make(counter++);
+                deque.push_front(value);
+                expected.push_front(value);
+            }
+
+            deque.append(gsl::span<const T> {source.data(), source.data() + source.size()});
+            expected.insert(expected.end(), source.begin(), source.end());
+            verify(deque, expected, "append span", offset, n);
+
+            deque.append(list_source.begin(), list_source.end());
+            expected.insert(expected.end(), source.begin(), source.end());
+            verify(deque, expected, "append list", offset, n);
+
+            deque.prepend(gsl::span<const T> {source.data(), source.data() + source.size()});
+            expected.insert(expected.begin(), source.begin(), source.end());
+            verify(deque, expected, "prepend span", offset, n);
+
+            deque.prepend(list_source.begin(), list_source.end());
+            expected.insert(expected.begin(), source.begin(), source.end());
+            verify(deque, expected, "prepend list", offset, n);
+
+            // The first inserted element, or the old end() if nothing was inserted
+            const auto old_size = deque.size();
+            auto iter = deque.insert(deque.end(), list_source.begin(), list_source.end());
+            expected.insert(expected.end(), source.begin(), source.end());
+            verify(deque, expected, "insert at end()", offset, n);
+            if (iter != deque.begin() + old_size) {
+                fprintf(stderr, "append_prepend_test<%s>: insert at end() returned element %td, expected %td\n",
+                        name, iter - deque.begin(), old_size);
+                std::abort();
+            }
+
+            iter = deque.insert(deque.begin(), source.begin(), source.end());
+            expected.insert(expected.begin(), source.begin(), source.end());
+            verify(deque, expected, "insert at begin()", offset, n);
+            if (iter != deque.begin()) {
+                fprintf(stderr, "append_prepend_test<%s>: insert at begin() returned element %td, expected 0\n", name,
+                        iter - deque.begin());
+                std::abort();
+            }
+        }
+    }
+}
+
+// Element whose copy constructor throws once a countdown runs out. Live instances are counted, so elements leaked or
+// destroyed twice show up
+struct ThrowingCopy {
+    static int num_live;
+    static int copies_left;
+
+    explicit ThrowingCopy(int v) : value {v} { ++num_live; }
+
+    ThrowingCopy(const ThrowingCopy& rhs) : value {rhs.value}
+    {
+        if (copies_left-- == 0) {
+            throw std::runtime_error {"ThrowingCopy"};
+        }
+        ++num_live;
+    }
+
+    ThrowingCopy& operator=(const ThrowingCopy&) = default;
+    ~ThrowingCopy() { --num_live; }
+
+    bool operator==(const ThrowingCopy& rhs) const { return value == rhs.value; }
+
+    int value;
+};
+
+int ThrowingCopy::num_live = 0;
+int ThrowingCopy::copies_left = -1;
+
+// prepend leaves the Deque as it was when a copy throws, append keeps the elements copied before it. Abort if they
+// don't, or if an element is leaked
+void append_prepend_throw_test()
+{
+    constexpr cls::size_type SUBARRAY_SIZE = 4;
+
+    std::vector<ThrowingCopy> source;
+    for (int i = 0; i < 3 * SUBARRAY_SIZE; ++i) {
+        source.emplace_back(100 + i);
+    }
+
+    for (int offset = 0; offset < SUBARRAY_SIZE; ++offset) {
+        for (int num_copies = 0; num_copies < static_cast<int>(source.size()); ++num_copies) {
+            {
+                cls::Deque<ThrowingCopy, SUBARRAY_SIZE> deque;
+                for (int i = 0; i < offset; ++i) {
+                    deque.push_front(ThrowingCopy {i});
+                }
+                const std::vector<ThrowingCopy> before {deque.begin(), deque.end()};
+
+                bool ok = false;
+                ThrowingCopy::copies_left = num_copies;
+                try {
+                    deque.prepend(source.begin(), source.end());
+                } catch (const std::runtime_error&) {
+                    ok = std::equal(before.begin(), before.end(), deque.begin(), deque.end());
+                }
+
+                ThrowingCopy::copies_left = num_copies;
+                try {
+                    deque.append(source.begin(), source.end());
+                    ok = false;
+                } catch (const std::runtime_error&) {
+                    ok = ok && deque.size() <= offset + num_copies &&
+                         std::equal(before.begin(), before.end(), deque.begin()) &&
+                         std::equal(deque.begin() + offset, deque.end(), source.begin());
+                }
+                ThrowingCopy::copies_left = -1;
+
+                if (!ok) {
+                    fprintf(stderr, "append_prepend_throw_test: wrong elements after copy %d threw, offset %d\n",
+                            num_copies, offset);
+                    std::abort();
+                }
+            }
+
+            if (ThrowingCopy::num_live != static_cast<int>(source.size())) {
+                fprintf(stderr, "append_prepend_throw_test: %d elements leaked\n",
+                        ThrowingCopy::num_live - static_cast<int>(source.size()));
+                std::abort();
+            }
+        }
+    }
+}
+
+// Record inserted and erased at random positions of a large container
+struct EditRecord {
+    long long timestamp;
+    double value;
+};
+
+inline bool operator==(const EditRecord& lhs, const EditRecord& rhs)
+{
+    return lhs.timestamp == rhs.timestamp && lhs.value == rhs.value;
+}
+
+// Fill container and apply the same random edits to it each time
+template <typename Container>
+void middle_edits(Container& deque, int num_elements, int num_edits, int edit_size)
+{
+    for (int i = 0; i < num_elements; ++i) {
+        deque.push_back({i, i * 0.5});
+    }
+
+    std::mt19937 rng;
+    std::uniform_int_distribution<int> dist(0, num_elements - edit_size);
+    for (int i = 0; i < num_edits; ++i) {
+        deque.insert(deque.begin() + dist(rng), edit_size, EditRecord {i, 0.0});
+        const auto pos = deque.begin() + dist(rng);
+        deque.erase(pos, pos + edit_size);
+    }
+}
+
+// Every edit shifts the shorter side of the container. Abort if the result differs from std::deque's
+template <typename Container>
+double middle_edit_test()
+{
+    constexpr int num_elements = 1 << 18;
+    constexpr int num_edits    = 2000;
+    constexpr int edit_size    = 16;
+
+    Container deque;
+    clock_t start = clock();
+    middle_edits(deque, num_elements, num_edits, edit_size);
+    clock_t end = clock();
+
+    std::deque<EditRecord> expected;
+    middle_edits(expected, num_elements, num_edits, edit_size);
+    if (static_cast<std::size_t>(deque.size()) != expected.size() ||
+        !std::equal(expected.begin(), expected.end(), deque.begin())) {
+        fprintf(stderr, "middle_edit_test: contents differ from std::deque\n");
+        std::abort();
+    }
+
+    return double(end - start) / 1000;
+}
+
+// Element that Deque shifts with memmove, but whose copy and move constructors throw once a countdown runs out. Live
+// instances are counted, so elements leaked or destroyed twice show up
+struct RelocatableThrower {
+    static int num_live;
+    static int copies_left;
+
+    explicit RelocatableThrower(int v) : value {v} { ++num_live; }
+
+    RelocatableThrower(const RelocatableThrower& rhs) : value {rhs.value}
+    {
+        count_copy();
+    }
+
+    RelocatableThrower(RelocatableThrower&& rhs) : value {rhs.value}
+    {
+        count_copy();
+    }
+
+    RelocatableThrower& operator=(const RelocatableThrower&) = default;
+    RelocatableThrower& operator=(RelocatableThrower&&) = default;
+    ~RelocatableThrower() { --num_live; }
+
+    bool operator==(const RelocatableThrower& rhs) const { return value == rhs.value; }
+
+    void count_copy()
+    {
+        if (copies_left-- == 0) {
+            throw std::runtime_error {"RelocatableThrower"};
+        }
+        ++num_live;
+    }
+
+    int value;
+};
+
+int RelocatableThrower::num_live = 0;
+int RelocatableThrower::copies_left = -1;
+
+namespace cls {
+template <>
+struct is_trivially_relocatable<RelocatableThrower> : std::true_type {};
+} // namespace cls
+
+// Random inserts, emplaces and erases at any position of a Deque with small subarrays, so shifts cross subarray
+// boundaries, against std::deque. Edits well inside one half must leave the other half where it is. Abort on the
+// first mismatch
+template <typename T, cls::size_type SUBARRAY_SIZE, typename Make>
+void middle_edit_check(const char* name, Make make)
+{
+    constexpr int num_edits = 20000;
+    constexpr int max_size  = 12 * SUBARRAY_SIZE;
+
+    cls::Deque<T, SUBARRAY_SIZE> deque;
+    std::deque<T> expected;
+    std::mt19937 rng;
+    int counter = 0;
+
+    for (int i = 0; i < num_edits; ++i) {
+        const auto size = static_cast<int>(expected.size());
+        const int op = rng() % (size > max_size ? 2 : 5);
+        int n = rng() % (SUBARRAY_SIZE + 2);
+        if (op < 2) {
+            n = std::min(n, size);
+        }
+        const int dist = rng() % (size - (op < 2 ? n : 0) + 1);
+
+        // Element on the far side of the edit, which must not move
+        const T* far_element = nullptr;
+        const bool in_front = dist * 4 < size;
+        const bool in_back = dist * 4 > size * 3 && size > 0;
+        if (in_front) {
+            far_element = &deque[size - 1];
+        } else if (in_back) {
+            far_element = &deque[0];
+        }
+
+        switch (op) {
+        case 0:
+            deque.erase(deque.begin() + dist, deque.begin() + dist + n);
+            expected.erase(expected.begin() + dist, expected.begin() + dist + n);
+            break;
+        case 1:
+            if (n > 0) {
+                deque.erase(deque.begin() + dist);
+                expected.erase(expected.begin() + dist);
+            }
+            break;
+        case 2: {
+            const auto value = make(counter++);
+            deque.insert(deque.begin() + dist, n, value);
+            if (n > 0) {
+                // libstdc++ 12 may drop elements when inserting nothing in the middle
+                expected.insert(expected.begin() + dist, n, value);
+            }
+            break;
+        }
+        case 3: {
+            std::vector<T> values;
+            for (int j = 0; j < n; ++j) {
+                values.push_back(make(counter++));
+            }
+            deque.insert(deque.begin() + dist, values.begin(), values.end());
+            if (n > 0) {
+                // libstdc++ 12 may drop elements here too
+                expected.insert(expected.begin() + dist, values.begin(), values.end());
+            }
+            break;
+        }
+        default: {
+            const auto value = make(counter++);
+            deque.emplace(deque.begin() + dist, value);
+            expected.emplace(expected.begin() + dist, value);
+            break;
+        }
+        }
+
+        const auto new_size = static_cast<cls::size_type>(expected.size());
+        if (deque.size() != new_size || !std::equal(expected.begin(), expected.end(), deque.begin())) {
+            fprintf(stderr, "middle_edit_check<%s>: edit %d (op %d at %d) differs from std::deque\n", name, i, op,
+                    dist);
+            std::abort();
+        }
+        if (new_size > 0 && ((in_front && far_element != &deque[new_size - 1]) ||
+                             (in_back && far_element != &deque[0]))) {
+            fprintf(stderr, "middle_edit_check<%s>: edit %d (op %d at %d) moved the longer side\n", name, i, op, dist);
+            std::abort();
+        }
+    }
+}
+
+// Inserts in the middle of a Deque of RelocatableThrower whose copies throw. The shifted elements must be moved back,
+// leaving the Deque as it was. Abort if they aren't, or if an element is leaked
+void middle_insert_throw_test()
+{
+    constexpr cls::size_type SUBARRAY_SIZE = 4;
+    constexpr int num_elements = 3 * SUBARRAY_SIZE + 1;
+    constexpr int n = SUBARRAY_SIZE + 1;
+
+    const std::vector<RelocatableThrower> values(n, RelocatableThrower {-1});
+    const auto base_live = RelocatableThrower::num_live;
+
+    for (int offset = 0; offset < SUBARRAY_SIZE; ++offset) {
+        for (int dist = 1; dist < num_elements; ++dist) {
+            for (int op = 0; op < 3; ++op) {
+                for (int num_copies = 0; num_copies <= n + 1; ++num_copies) {
+                    {
+                        cls::Deque<RelocatableThrower, SUBARRAY_SIZE> deque;
+                        for (int i = 0; i < offset; ++i) {
+                            deque.push_back(RelocatableThrower {0});
+                        }
+                        for (int i = 0; i < num_elements; ++i) {
+                            deque.push_back(RelocatableThrower {i});
+                        }
+                        deque.erase(deque.begin(), deque.begin() + offset);
+                        std::deque<RelocatableThrower> expected {deque.begin(), deque.end()};
+
+                        const auto pos = deque.begin() + dist;
+                        RelocatableThrower::copies_left = num_copies;
+                        try {
+                            if (op == 0) {
+                                deque.insert(pos, n, values[0]);
+                            } else if (op == 1) {
+                                deque.insert(pos, values.begin(), values.end());
+                            } else {
+                                deque.emplace(pos, -1);
+                            }
+                            RelocatableThrower::copies_left = -1;
+                            expected.insert(expected.begin() + dist, op == 2 ? 1 : n, values[0]);
+                        } catch (const std::runtime_error&) {
+                        }
+                        RelocatableThrower::copies_left = -1;
+
+                        if (deque.size() != static_cast<cls::size_type>(expected.size()) ||
+                            !std::equal(expected.begin(), expected.end(), deque.begin())) {
+                            fprintf(stderr, "middle_insert_throw_test: op %d at %d, offset %d, copy %d: wrong "
+                                            "elements\n", op, dist, offset, num_copies);
+                            std::abort();
+                        }
+                    }
+
+                    if (RelocatableThrower::num_live != base_live) {
+                        fprintf(stderr, "middle_insert_throw_test: op %d at %d: %d elements leaked\n", op, dist,
+                                RelocatableThrower::num_live - base_live);
+                        std::abort();
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Window of the last samples, summed every few samples. A Deque has to pop the oldest sample itself, a RingDeque
+// overwrites it, so it only pushes. Abort if a sum is wrong
+template <typename Window, bool OVERWRITES = false>
+double sliding_window_test()
+{
+    constexpr int num_samples = 10000000;
+    constexpr int window_size = 1024;
+    constexpr int sum_period  = 64;
+
+    Window window;
+    long long sum = 0;
+    long long expected = 0;
+    clock_t start = clock();
+    for (int i = 0; i < num_samples; ++i) {
+        window.push_back(i);
+        if (!OVERWRITES && window.size() > window_size) {
+            window.pop_front();
+        }
+        if (i % sum_period == 0) {
+            sum += cls::accumulate(window, 0LL, std::plus<> {});
+
+            // Samples first to i
+            const long long first = std::max(0, i - window_size + 1);
+            expected += (first + i) * (i - first + 1) / 2;
+        }
+    }
+    clock_t end = clock();
+
+    if (sum != expected) {
+        fprintf(stderr, "sliding_window_test: sum of windows %lld, expected %lld\n", sum, expected);
+        std::abort();
+    }
+
+    return double(end - start) / 1000;
+}
+
+// RingDeque against a std::deque trimmed to N by hand, through random pushes and pops which wrap around the storage
+// many times. Elements, operator[], iterators both ways and segments() are compared after every operation. Abort on
+// the first mismatch
+template <cls::size_type N>
+void ring_deque_test()
+{
+    constexpr int num_ops = 100000;
+
+    cls::RingDeque<std::string, N> ring;
+    std::deque<std::string> expected;
+    auto check = [&](const char* op, int step) {
+        const auto& const_ring = ring;
+        const auto segments = const_ring.segments();
+        std::vector<std::string> segment_elements;
+        for (const auto& segment : segments) {
+            segment_elements.insert(segment_elements.end(), segment.begin(), segment.end());
+        }
+
+        bool ok = ring.size() == static_cast<cls::size_type>(expected.size()) &&
+                  ring.full() == (expected.size() == N) &&
+                  std::equal(expected.begin(), expected.end(), ring.begin()) &&
+                  std::equal(expected.rbegin(), expected.rend(), ring.rbegin()) &&
+                  std::equal(expected.begin(), expected.end(), segment_elements.begin(), segment_elements.end()) &&
+                  (expected.empty() || (ring.front() == expected.front() && ring.back() == expected.back() &&
+                                        &*segments[0].begin() == &ring.front()));
+        for (cls::size_type i = 0; ok && i < ring.size(); ++i) {
+            ok = ring[i] == expected[i] && &ring[i] == &*(ring.begin() + i);
+        }
+
+        if (!ok) {
+            fprintf(stderr, "ring_deque_test<%td>: differs from std::deque after %s at step %d\n", N, op, step);
+            std::abort();
+        }
+    };
+
+    std::mt19937 rng {1};
+    for (int step = 0; step < num_ops; ++step) {
+        const auto op = rng() % 8;
+        if (op < 5) {
+            // Overwrites the oldest element once full
+            auto value = "element " + std::to_string(step) + " with some padding";
+            expected.push_back(value);
+            if (expected.size() > N) {
+                expected.pop_front();
+            }
+            ring.push_back(std::move(value));
+            check("push_back", step);
+        } else if (op == 5 && !expected.empty()) {
+            expected.pop_front();
+            ring.pop_front();
+            check("pop_front", step);
+        } else if (op == 6 && !expected.empty()) {
+            expected.pop_back();
+            ring.pop_back();
+            check("pop_back", step);
+        } else if (op == 7 && rng() % 64 == 0) {
+            auto copy = ring;
+            ring = std::move(copy);
+            check("copy and move", step);
+        }
+    }
+}
+
+// Per-thread Deques of records concatenated into one every tick, by copying their elements or by splicing their
+// subarrays. Splicing hands subarrays over when a Deque ends at the offset where the next one begins, which is the
+// case when batch_size is a multiple of the subarray size
+double concat_test(bool splice, int batch_size)
+{
+    constexpr int num_threads = 8;
+    constexpr int num_ticks   = 100;
+
+    std::vector<cls::Deque<EditRecord>> batches(num_threads);
+    cls::Deque<EditRecord> merged;
+    long long total = 0;
+    clock_t elapsed = 0;
+    for (int tick = 0; tick < num_ticks; ++tick) {
+        for (auto& batch : batches) {
+            for (int i = 0; i < batch_size; ++i) {
+                batch.push_back({i, tick * 0.5});
+            }
+        }
+
+        clock_t start = clock();
+        for (auto& batch : batches) {
+            if (splice) {
+                merged.splice_back(std::move(batch));
+            } else {
+                for (auto segment : batch.segments()) {
+                    merged.append(gsl::span<const EditRecord> {segment});
+                }
+                batch.clear();
+            }
+        }
+        elapsed += clock() - start;
+
+        total += merged.size();
+        merged.clear();
+    }
+
+    return total == (long long)num_ticks * num_threads * batch_size ? double(elapsed) / 1000 : 0;
+}
+
+// Deque::splice_back, splice_front and split_at checked against std::deques which do the same by copying. Small
+// subarrays make every offset in a subarray common, so subarrays are handed over when the offsets line up and
+// elements are moved otherwise. Every split position of small Deques is tried, at 0, at size() and at subarray
+// boundaries included, then random sequences of operations. Abort on the first mismatch, return wall time in ms
+template <typename T, cls::size_type SUBARRAY_SIZE, typename Make>
+double splice_split_test(const char* name, Make make)
+{
+    using DequeT = cls::Deque<T, SUBARRAY_SIZE>;
+    constexpr int num_deques = 4;
+    constexpr int num_ops    = 20000;
+
+    std::vector<DequeT> deques(num_deques);
+    std::vector<std::deque<T>> expected(num_deques);
+    int counter = 0;
+
+    // Elements pushed at the front first, so num_front sets where the Deque begins in its first subarray
+    auto build = [&](int k, int num_front, int num_back) {
+        deques[k].clear();
+        expected[k].clear();
+        for (int i = 0; i < num_front; ++i) {
+            auto value = make(counter++);
+            deques[k].push_front(value);
+            expected[k].push_front(value);
+        }
+        for (int i = 0; i < num_back; ++i) {
+            auto value = make(counter++);
+            deques[k].push_back(value);
+            expected[k].push_back(value);
+        }
+    };
+
+    auto verify = [&](const char* op) {
+        for (int k = 0; k < num_deques; ++k) {
+            const auto& deque = deques[k];
+            const auto& std_deque = expected[k];
+            if (deque.size() != static_cast<cls::size_type>(std_deque.size()) ||
+                !std::equal(std_deque.begin(), std_deque.end(), deque.begin()) ||
+                !std::equal(std_deque.rbegin(), std_deque.rend(), deque.rbegin())) {
+                fprintf(stderr, "splice_split_test<%s>: deque %d differs from std::deque after %s\n", name, k, op);
+                std::abort();
+            }
+        }
+    };
+
+    auto splice_back = [&](int i, int j) {
+        deques[i].splice_back(std::move(deques[j]));
+        expected[i].insert(expected[i].end(), expected[j].begin(), expected[j].end());
+        expected[j].clear();
+    };
+
+    auto splice_front = [&](int i, int j) {
+        deques[i].splice_front(std::move(deques[j]));
+        expected[i].insert(expected[i].begin(), expected[j].begin(), expected[j].end());
+        expected[j].clear();
+    };
+
+    auto split_at = [&](int i, int j, cls::size_type n) {
+        deques[j] = deques[i].split_at(n);
+        expected[j].assign(expected[i].begin() + n, expected[i].end());
+        expected[i].erase(expected[i].begin() + n, expected[i].end());
+    };
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Every pair of offsets, empty sides included
+    const int sizes[] = {0, 1, int(SUBARRAY_SIZE), 2 * int(SUBARRAY_SIZE) + 1};
+    for (int lhs_front = 0; lhs_front <= SUBARRAY_SIZE; ++lhs_front) {
+        for (int rhs_front = 0; rhs_front <= SUBARRAY_SIZE; ++rhs_front) {
+            for (auto lhs_back : sizes) {
+                for (auto rhs_back : sizes) {
+                    build(0, lhs_front, lhs_back);
+                    build(1, rhs_front, rhs_back);
+                    splice_back(0, 1);
+                    verify("splice_back");
+
+                    build(1, rhs_front, rhs_back);
+                    build(2, lhs_front, lhs_back);
+                    splice_front(2, 1);
+                    verify("splice_front");
+                }
+            }
+        }
+    }
+
+    // Every split position
+    for (int front = 0; front <= SUBARRAY_SIZE; ++front) {
+        for (cls::size_type n = 0; n <= 3 * SUBARRAY_SIZE + 1; ++n) {
+            build(0, front, 3 * SUBARRAY_SIZE + 1 - front);
+            split_at(0, 1, n);
+            verify("split_at");
+
+            // Splicing the tail back restores the original
+            splice_back(0, 1);
+            verify("split_at and splice_back");
+        }
+    }
+
+    std::mt19937 rng {1};
+    for (int op = 0; op < num_ops; ++op) {
+        const int i = rng() % num_deques;
+        const int j = rng() % num_deques;
+        auto& deque = deques[i];
+        auto& std_deque = expected[i];
+
+        switch (rng() % 6) {
+        case 0:
+        case 1:
+            for (auto n = rng() % (3 * SUBARRAY_SIZE); n > 0; --n) {
+                auto value = make(counter++);
+                if (rng() % 2 == 0) {
+                    deque.push_back(value);
+                    std_deque.push_back(value);
+                } else {
+                    deque.push_front(value);
+                    std_deque.push_front(value);
+                }
+            }
+            break;
+        case 2:
+            if (i != j) {
+                splice_back(i, j);
+            }
+            break;
+        case 3:
+            if (i != j) {
+                splice_front(i, j);
+            }
+            break;
+        case 4:
+            if (i != j) {
+                split_at(i, j, rng() % (std_deque.size() + 1));
+            }
+            break;
+        default:
+            for (auto n = std_deque.empty() ? 0 : rng() % (std_deque.size() + 1); n > 0; --n) {
+                if (rng() % 2 == 0) {
+                    deque.pop_back();
+                    std_deque.pop_back();
+                } else {
+                    deque.pop_front();
+                    std_deque.pop_front();
+                }
+            }
+        }
+        verify("random operation");
+    }
+
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Node based std container bound to a given allocator, independent of the active allocator
+double stl_list_test(cls::Allocator& alloc)
+{
+    std::list<int, cls::STLAllocator<int>> list {cls::STLAllocator<int> {alloc}};
+
+    clock_t start = clock();
+    for (int round = 0; round < 10; ++round) {
+        for (int i = 0; i < 1000000; ++i) {
+            list.push_back(i);
+        }
+        list.clear();
+    }
+    clock_t end = clock();
+
+    return double(end - start) / 1000;
+}
+
+// Per-frame temporaries allocated and freed in LIFO order, rewind instead of freeing them if stack is given
+double scratch_test(cls::Allocator& alloc, cls::StackAllocator* stack)
+{
+    constexpr int num_frames = 1000000;
+    constexpr int num_temps  = 16;
+
+    std::array<void*, num_temps> temps;
+    std::array<cls::size_type, num_temps> sizes;
+    for (int i = 0; i < num_temps; ++i) {
+        sizes[i] = 32 << (i % 8);
+    }
+
+    clock_t start = clock();
+    for (int frame = 0; frame < num_frames; ++frame) {
+        const auto marker = stack != nullptr ? stack->mark() : 0;
+        for (int i = 0; i < num_temps; ++i) {
+            temps[i] = alloc.allocate(sizes[i]);
+            static_cast<char*>(temps[i])[0] = char(frame);
+        }
+        if (stack != nullptr) {
+            stack->rewind(marker);
+        } else {
+            for (int i = num_temps - 1; i >= 0; --i) {
+                alloc.deallocate(temps[i], sizes[i]);
+            }
+        }
+    }
+    clock_t end = clock();
+
+    return double(end - start) / 1000;
+}
+
+// Build a Deque in a file, then reopen it instead of building it again
+void persistent_deque_test()
+{
+    using DequeT = cls::Deque<int>;
+    constexpr int num_elements = 1 << 24;
+    const auto file_path = temp_path("persistent_deque.bin");
+    const char* path = file_path.c_str();
+    std::remove(path);
+
+    clock_t start = clock();
+    {
+        cls::MmapFileAllocator file_alloc {path};
+        cls::ScopedActiveAllocator scope {file_alloc};
+        auto deque = ::new(file_alloc.allocate(cls::size_of<DequeT>, cls::align_of<DequeT>)) DequeT;
+        for (int i = 0; i < num_elements; ++i) {
+            deque->push_back(i);
+        }
+        file_alloc.set_root(deque);
+    }
+    clock_t end = clock();
+    printf("%-18s build %f, ", "MmapFileAllocator", double(end - start) / 1000);
+
+    start = clock();
+    cls::MmapFileAllocator file_alloc {path};
+    if (!file_alloc.same_address()) {
+        printf("reopened at another address\n");
+        std::remove(path);
+        return;
+    }
+    auto deque = static_cast<DequeT*>(file_alloc.root());
+    const auto size = deque->size();
+    end = clock();
+    printf("reopen %f, %td elements, file %td MiB\n", double(end - start) / 1000, size, file_alloc.size() >> 20);
+
+    cls::ScopedActiveAllocator scope {file_alloc};
+    deque->~DequeT();
+    std::remove(path);
+}
+
+void allocator_performance_test()
+{
+    auto run = [](const char* name) {
+        printf("%-18s subarray<int> %f, subarray<string> %f, fifo %f\n", name,
+               subarray_alloc_test<int>(), subarray_alloc_test<std::string>(), deque_fifo_test());
+    };
+
+    cls::ActiveAllocator::reset(std::make_unique<cls::DefaultAllocator>());
+    run("DefaultAllocator");
+
+    cls::ActiveAllocator::reset(std::make_unique<cls::PoolAllocator>());
+    run("PoolAllocator");
+
+    cls::ActiveAllocator::reset(std::make_unique<cls::DefaultAllocator>());
+
+    printf("%-18s short-lived %f\n", "DefaultAllocator", short_lived_test(nullptr));
+    {
+        cls::ArenaAllocator arena;
+        cls::ScopedActiveAllocator scope {arena};
+        printf("%-18s short-lived %f\n", "ArenaAllocator", short_lived_test(&arena));
+    }
+
+    // Allocator bound at compile time, no active allocator lookup or virtual call per subarray
+    using cls::StaticAllocatorPolicy;
+    constexpr auto SIZE = cls::detail::DEFAULT_SUBARRAY_SIZE<int>;
+    printf("%-18s static fifo %f\n", "DefaultAllocator",
+           deque_fifo_test<cls::Deque<int, SIZE, StaticAllocatorPolicy<cls::DefaultAllocator>>>());
+    printf("%-18s static fifo %f\n", "PoolAllocator",
+           deque_fifo_test<cls::Deque<int, SIZE, StaticAllocatorPolicy<cls::PoolAllocator>>>());
+    printf("%-18s static fifo %f\n", "SlabAllocator",
+           deque_fifo_test<cls::Deque<int, SIZE, StaticAllocatorPolicy<cls::TypedSlabAllocator<int, SIZE>>>>());
+
+    // Subarray sized blocks allocated in one thread and freed in another
+    constexpr auto block_size = SIZE * cls::size_of<int>;
+    cls::DefaultAllocator default_alloc;
+    cls::PoolAllocator pool_alloc;
+    cls::PoolAllocator remote_pool_alloc {cls::PoolAllocator::FreeMode::REMOTE};
+    cls::SlabAllocator slab_alloc {block_size};
+    printf("%-18s cross-thread free %fms\n", "DefaultAllocator", cross_thread_free_test(default_alloc, block_size));
+    printf("%-18s cross-thread free %fms\n", "PoolAllocator", cross_thread_free_test(pool_alloc, block_size));
+    printf("%-18s cross-thread free %fms\n", "PoolAllocator/R",
+           cross_thread_free_test(remote_pool_alloc, block_size));
+    printf("%-18s cross-thread free %fms\n", "SlabAllocator", cross_thread_free_test(slab_alloc, block_size));
+
+    printf("%-18s messages %fms\n", "Deque+mutex", message_passing_test(Channel::LOCKED));
+    printf("%-18s messages %fms, batched %fms\n", "SpscDeque", message_passing_test(Channel::SPSC),
+           message_passing_test(Channel::SPSC_BATCH));
+    printf("%-18s stress %fms\n", "SpscDeque", spsc_stress_test());
+
+    printf("%-18s tasks, 3 thieves %fms\n", "Deque+mutex", work_stealing_test<LockedDeque>(3));
+    printf("%-18s tasks, 1 thief %fms, 3 thieves %fms\n", "WorkStealingDeque", work_stealing_test(1),
+           work_stealing_test(3));
+
+    spare_subarray_test(0);
+    spare_subarray_test(cls::detail::DEFAULT_SPARE_SUBARRAYS);
+
+    {
+        cls::DefaultAllocator upstream;
+        cls::StatsAllocator stats_alloc {upstream};
+        cls::ScopedActiveAllocator scope {stats_alloc};
+        printf("%-18s fifo %f\n", "StatsAllocator", deque_fifo_test());
+        stats_alloc.report(std::cout);
+    }
+
+    {
+        // Trace for replay_alloc_trace
+        const auto path = temp_path("deque_fifo.trace");
+
+        cls::DefaultAllocator upstream;
+        {
+            cls::TracingAllocator tracing_alloc {upstream, path};
+            cls::ScopedActiveAllocator scope {tracing_alloc};
+            printf("%-18s fifo %f\n", "TracingAllocator", deque_fifo_test());
+        }
+        printf("%-18s %zu events in deque_fifo.trace\n", "TracingAllocator", cls::read_alloc_trace(path).size());
+        std::remove(path.c_str());
+    }
+
+    {
+        cls::ArenaAllocator arena;
+        printf("%-18s std::list %f\n", "DefaultAllocator", stl_list_test(default_alloc));
+        printf("%-18s std::list %f\n", "PoolAllocator", stl_list_test(pool_alloc));
+        printf("%-18s std::list %f\n", "ArenaAllocator", stl_list_test(arena));
+    }
+
+    {
+        cls::StackAllocator stack {1 << 20};
+        printf("%-18s scratch %f\n", "DefaultAllocator", scratch_test(default_alloc, nullptr));
+        printf("%-18s scratch %f\n", "PoolAllocator", scratch_test(pool_alloc, nullptr));
+        printf("%-18s scratch %f\n", "StackAllocator", scratch_test(stack, nullptr));
+        printf("%-18s scratch rewind %f\n", "StackAllocator", scratch_test(stack, &stack));
+    }
+
+    persistent_deque_test();
+
+    // Sampling overhead, and where the live bytes of a large Deque come from
+    {
+        cls::HeapProfiler::start();
+        printf("%-18s fifo %f\n", "HeapProfiler", deque_fifo_test());
+        cls::Deque<int> deque;
+        for (int i = 0; i < 1 << 22; ++i) {
+            deque.push_back(i);
+        }
+        cls::HeapProfiler::report(std::cout, 2);
+        cls::HeapProfiler::reset();
+    }
+
+    element_access_test<4>();
+    element_access_test<64>();
+    printf("%-18s random access %f, iteration %f, segmented iteration %f\n", "DefaultAllocator",
+           random_access_test(), iteration_test(false), iteration_test(true));
+    printf("%-18s random access %f\n", "std::deque", random_access_test<std::deque<int>>());
+    append_prepend_test<int, 8>("int", [](int i) { return i; });
+    append_prepend_test<std::string, 8>("string", [](int i) { return std::to_string(i) + " and some padding"; });
+    append_prepend_throw_test();
+    printf("%-18s ingest push_back %f, append %f\n", "Deque", ingest_test(false), ingest_test(true));
+    middle_edit_check<EditRecord, 4>("EditRecord", [](int i) { return EditRecord {i, i * 0.5}; });
+    middle_edit_check<std::string, 4>("string", [](int i) { return std::to_string(i) + " and some padding"; });
+    middle_edit_check<RelocatableThrower, 4>("RelocatableThrower", [](int i) { return RelocatableThrower {i}; });
+    middle_insert_throw_test();
+    printf("%-18s middle insert/erase %f\n", "Deque", middle_edit_test<cls::Deque<EditRecord>>());
+    printf("%-18s middle insert/erase %f\n", "std::deque", middle_edit_test<std::deque<EditRecord>>());
+    printf("%-18s concat copy %f, splice %f, unaligned splice %f\n", "Deque", concat_test(false, 1 << 16),
+           concat_test(true, 1 << 16), concat_test(true, (1 << 16) + 5));
+    printf("%-18s splice/split check int %f, string %f\n", "Deque",
+           splice_split_test<int, 4>("int", [](int i) { return i; }),
+           splice_split_test<std::string, 8>("string", [](int i) { return std::to_string(i) + " and some padding"; }));
+    printf("%-18s sliding window %f\n", "Deque", sliding_window_test<cls::Deque<int>>());
+    ring_deque_test<1>();
+    ring_deque_test<8>();
+    printf("%-18s sliding window %f\n", "RingDeque", sliding_window_test<cls::RingDeque<int, 1024>, true>());
+    printf("%-18s random access %f\n", "std::vector", random_access_test<std::vector<int>>());
+    {
+        cls::HugePageAllocator huge_page_alloc;
+        cls::ScopedActiveAllocator scope {huge_page_alloc};
+        const auto elapsed = random_access_test();
+        printf("%-18s random access %f (%s)\n", "HugePageAllocator", elapsed,
+               cls::HugePageAllocator::mode_name(huge_page_alloc.mode()));
+    }
+}
+
 int main(/*int argc, char* argv[]*/)
 {
     performance_test();
+    allocator_performance_test();
 
     return 0;
 }
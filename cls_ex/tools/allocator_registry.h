@@ -0,0 +1,84 @@
+/////////////////////////////////////////////////////////////////////////////////
+// The MIT License(MIT)
+//
+// Copyright (c) 2016 Tiangang Song
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+/////////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cls_ex/allocator.h>
+#include <cls_ex/deque_x.h>
+
+CLS_BEGIN
+namespace tools {
+struct RegisteredAllocator {
+    std::string name;
+    std::function<std::unique_ptr<Allocator>()> make;
+};
+
+// Allocators the tools can be pointed at by name, new implementations are added here
+inline const std::vector<RegisteredAllocator>& registered_allocators()
+{
+    // Deque<int> subarrays
+    static constexpr auto slab_block_size = detail::DEFAULT_SUBARRAY_SIZE<int> * size_of<int>;
+
+    static const std::vector<RegisteredAllocator> allocators {
+        {"default",     [] { return std::unique_ptr<Allocator> {std::make_unique<DefaultAllocator>()}; }},
+        {"pool",        [] { return std::unique_ptr<Allocator> {std::make_unique<PoolAllocator>()}; }},
+        {"pool-remote", [] {
+             return std::unique_ptr<Allocator> {std::make_unique<PoolAllocator>(PoolAllocator::FreeMode::REMOTE)};
+         }},
+        {"slab",        [] { return std::unique_ptr<Allocator> {std::make_unique<SlabAllocator>(slab_block_size)}; }},
+        {"huge-page",   [] { return std::unique_ptr<Allocator> {std::make_unique<HugePageAllocator>()}; }},
+        {"arena",       [] { return std::unique_ptr<Allocator> {std::make_unique<ArenaAllocator>()}; }},
+    };
+
+    return allocators;
+}
+
+// Return nullptr for an unknown name
+inline std::unique_ptr<Allocator> make_allocator(const std::string& name)
+{
+    for (const auto& allocator : registered_allocators()) {
+        if (allocator.name == name) {
+            return allocator.make();
+        }
+    }
+
+    return nullptr;
+}
+
+inline std::string allocator_names()
+{
+    std::string names;
+    for (const auto& allocator : registered_allocators()) {
+        names += (names.empty() ? "" : ", ") + allocator.name;
+    }
+
+    return names;
+}
+}
+CLS_END
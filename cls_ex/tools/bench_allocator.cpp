@@ -0,0 +1,410 @@
+/////////////////////////////////////////////////////////////////////////////////
+// The MIT License(MIT)
+//
+// Copyright (c) 2016 Tiangang Song
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+/////////////////////////////////////////////////////////////////////////////////
+
+// Allocator benchmark suite. Runs each workload against DefaultAllocator and the other chosen allocators, and writes
+// ops/s, p50/p99 latency and the speedup over DefaultAllocator as JSON or CSV.
+//
+//   bench_allocator --allocators pool,slab --format csv
+//
+// Workloads:
+//   churn         one thread frees a random live block and allocates a new one, sizes 16 to 256 bytes
+//   churn-mt      the same on all threads at once, sharing one allocator
+//   handoff       one thread allocates blocks, another one frees them
+//   mixed         churn with sizes from 16 bytes to 64 KiB, log-uniform
+//   deque         Deque<int> used as a FIFO queue, allocating and freeing subarrays all the time
+//
+// Latency is measured on every LATENCY_SAMPLE_INTERVAL-th operation only, so the clock doesn't dominate throughput.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <boost/program_options.hpp>
+#include <cls_ex/allocator.h>
+#include <cls_ex/deque_x.h>
+#include "allocator_registry.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr cls::size_type LATENCY_SAMPLE_INTERVAL = 64;
+constexpr cls::size_type NUM_LIVE_BLOCKS = 1000;
+
+struct Options {
+    cls::size_type num_ops;
+    int num_threads;
+};
+
+struct Measurement {
+    cls::size_type num_ops = 0;
+    double seconds = 0;
+    std::vector<std::int64_t> latencies;
+};
+
+struct Result {
+    std::string workload;
+    std::string allocator;
+    int num_threads;
+    cls::size_type num_ops;
+    double ops_per_sec;
+    double p50_ns;
+    double p99_ns;
+    double speedup;
+};
+
+template <typename Func>
+void run_timed(cls::size_type i, std::vector<std::int64_t>& latencies, Func&& func)
+{
+    if (i % LATENCY_SAMPLE_INTERVAL != 0) {
+        func();
+        return;
+    }
+
+    const auto start = Clock::now();
+    func();
+    latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+double seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Sizes for churn, drawn up front so the RNG is not measured
+std::vector<cls::size_type> make_sizes(cls::size_type count, cls::size_type min_size, cls::size_type max_size,
+                                       unsigned seed)
+{
+    std::mt19937 rng {seed};
+    std::uniform_real_distribution<double> log_size(std::log2(double(min_size)), std::log2(double(max_size)));
+
+    std::vector<cls::size_type> sizes(static_cast<size_t>(count));
+    for (auto& size : sizes) {
+        size = static_cast<cls::size_type>(std::exp2(log_size(rng)));
+    }
+
+    return sizes;
+}
+
+// Replace a random live block by a new one num_ops times
+Measurement churn(cls::Allocator& alloc, cls::size_type num_ops, cls::size_type min_size, cls::size_type max_size,
+                  unsigned seed)
+{
+    const auto sizes = make_sizes(num_ops + NUM_LIVE_BLOCKS, min_size, max_size, seed);
+    std::vector<std::uint32_t> slots(static_cast<size_t>(num_ops));
+    std::mt19937 rng {seed};
+    for (auto& slot : slots) {
+        slot = static_cast<std::uint32_t>(rng() % NUM_LIVE_BLOCKS);
+    }
+
+    std::vector<std::pair<void*, cls::size_type>> live(NUM_LIVE_BLOCKS);
+    for (cls::size_type i = 0; i < NUM_LIVE_BLOCKS; ++i) {
+        live[i] = {alloc.allocate(sizes[num_ops + i]), sizes[num_ops + i]};
+    }
+
+    Measurement measurement;
+    measurement.latencies.reserve(static_cast<size_t>(num_ops / LATENCY_SAMPLE_INTERVAL + 1));
+
+    const auto start = Clock::now();
+    for (cls::size_type i = 0; i < num_ops; ++i) {
+        auto& block = live[slots[i]];
+        run_timed(i, measurement.latencies, [&] {
+            alloc.deallocate(block.first, block.second);
+            block = {alloc.allocate(sizes[i]), sizes[i]};
+        });
+    }
+    measurement.seconds = seconds_since(start);
+    measurement.num_ops = num_ops;
+
+    for (auto& block : live) {
+        alloc.deallocate(block.first, block.second);
+    }
+
+    return measurement;
+}
+
+Measurement churn_single(cls::Allocator& alloc, const Options& options)
+{
+    return churn(alloc, options.num_ops, 16, 256, 1);
+}
+
+Measurement mixed(cls::Allocator& alloc, const Options& options)
+{
+    return churn(alloc, options.num_ops, 16, 1 << 16, 1);
+}
+
+Measurement churn_multi(cls::Allocator& alloc, const Options& options)
+{
+    std::vector<Measurement> measurements(static_cast<size_t>(options.num_threads));
+    std::vector<std::thread> threads;
+    for (int i = 0; i < options.num_threads; ++i) {
+        threads.emplace_back([&, i] {
+            measurements[i] = churn(alloc, options.num_ops / options.num_threads, 16, 256, unsigned(i + 1));
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Threads run concurrently, the slowest one decides the throughput
+    Measurement total;
+    for (auto& measurement : measurements) {
+        total.num_ops += measurement.num_ops;
+        total.seconds = std::max(total.seconds, measurement.seconds);
+        total.latencies.insert(total.latencies.end(), measurement.latencies.begin(), measurement.latencies.end());
+    }
+
+    return total;
+}
+
+// Blocks are passed through a ring from the producer to the consumer
+Measurement handoff(cls::Allocator& alloc, const Options& options)
+{
+    constexpr int ring_size = 1024;
+    constexpr cls::size_type block_size = 64;
+
+    std::array<std::atomic<void*>, ring_size> ring {};
+    std::vector<std::int64_t> producer_latencies;
+    std::vector<std::int64_t> consumer_latencies;
+
+    const auto start = Clock::now();
+    std::thread producer([&] {
+        for (cls::size_type i = 0; i < options.num_ops; ++i) {
+            void* p = nullptr;
+            run_timed(i, producer_latencies, [&] { p = alloc.allocate(block_size); });
+            auto& slot = ring[i % ring_size];
+            while (slot.load(std::memory_order_acquire) != nullptr) {
+                std::this_thread::yield();
+            }
+            slot.store(p, std::memory_order_release);
+        }
+    });
+
+    std::thread consumer([&] {
+        for (cls::size_type i = 0; i < options.num_ops; ++i) {
+            auto& slot = ring[i % ring_size];
+            void* p = nullptr;
+            while ((p = slot.load(std::memory_order_acquire)) == nullptr) {
+                std::this_thread::yield();
+            }
+            slot.store(nullptr, std::memory_order_release);
+            run_timed(i, consumer_latencies, [&] { alloc.deallocate(p, block_size); });
+        }
+    });
+
+    producer.join();
+    consumer.join();
+
+    Measurement measurement;
+    measurement.seconds = seconds_since(start);
+    measurement.num_ops = 2 * options.num_ops;
+    measurement.latencies = std::move(producer_latencies);
+    measurement.latencies.insert(measurement.latencies.end(), consumer_latencies.begin(), consumer_latencies.end());
+
+    return measurement;
+}
+
+// One op is a push_back, and a pop_front once the queue is full
+Measurement deque_blocks(cls::Allocator& alloc, const Options& options)
+{
+    constexpr cls::size_type queue_size = 10000;
+
+    cls::ScopedActiveAllocator scope {alloc};
+    cls::Deque<int> queue;
+    Measurement measurement;
+
+    const auto start = Clock::now();
+    for (cls::size_type i = 0; i < options.num_ops; ++i) {
+        run_timed(i, measurement.latencies, [&] {
+            queue.push_back(int(i));
+            if (queue.size() > queue_size) {
+                queue.pop_front();
+            }
+        });
+    }
+    measurement.seconds = seconds_since(start);
+    measurement.num_ops = options.num_ops;
+
+    return measurement;
+}
+
+struct Workload {
+    const char* name;
+    Measurement (*run)(cls::Allocator&, const Options&);
+    bool multi_threaded;
+};
+
+const std::array<Workload, 5> WORKLOADS {{
+    {"churn",    churn_single, false},
+    {"churn-mt", churn_multi,  true},
+    {"handoff",  handoff,      true},
+    {"mixed",    mixed,        false},
+    {"deque",    deque_blocks, false},
+}};
+
+double percentile(std::vector<std::int64_t>& values, double p)
+{
+    if (values.empty()) {
+        return 0;
+    }
+
+    auto nth = values.begin() + static_cast<std::ptrdiff_t>(p * double(values.size() - 1));
+    std::nth_element(values.begin(), nth, values.end());
+    return double(*nth);
+}
+
+std::vector<std::string> split(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream ss {list};
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+
+    return items;
+}
+
+void write_csv(std::ostream& os, const std::vector<Result>& results)
+{
+    os << "workload,allocator,threads,ops,ops_per_sec,p50_ns,p99_ns,speedup\n";
+    for (const auto& result : results) {
+        os << result.workload << "," << result.allocator << "," << result.num_threads << "," << result.num_ops << ","
+           << result.ops_per_sec << "," << result.p50_ns << "," << result.p99_ns << "," << result.speedup << "\n";
+    }
+}
+
+void write_json(std::ostream& os, const std::vector<Result>& results)
+{
+    os << "[\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& result = results[i];
+        os << "  {\"workload\": \"" << result.workload << "\", \"allocator\": \"" << result.allocator
+           << "\", \"threads\": " << result.num_threads << ", \"ops\": " << result.num_ops
+           << ", \"ops_per_sec\": " << result.ops_per_sec << ", \"p50_ns\": " << result.p50_ns
+           << ", \"p99_ns\": " << result.p99_ns << ", \"speedup\": " << result.speedup << "}"
+           << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    os << "]\n";
+}
+}
+
+int main(int argc, char* argv[])
+{
+    namespace po = boost::program_options;
+
+    std::string allocator_list;
+    std::string workload_list;
+    std::string format;
+    Options options {};
+
+    po::options_description description("Options");
+    description.add_options()
+        ("help,h", "Show this help")
+        ("allocators,a", po::value(&allocator_list)->default_value("pool,pool-remote,slab,huge-page"),
+         ("Allocators compared with default: " + cls::tools::allocator_names()).c_str())
+        ("workloads,w", po::value(&workload_list)->default_value("churn,churn-mt,handoff,mixed,deque"),
+         "Workloads to run")
+        ("ops,n", po::value(&options.num_ops)->default_value(1000000), "Operations per workload")
+        ("threads,t", po::value(&options.num_threads)->default_value(
+             static_cast<int>(std::max(2u, std::thread::hardware_concurrency()))), "Threads for churn-mt")
+        ("format,f", po::value(&format)->default_value("json"), "json or csv");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, description), vm);
+        if (vm.count("help")) {
+            std::cout << "Usage: bench_allocator [options]\n" << description;
+            return 0;
+        }
+        po::notify(vm);
+    } catch (const po::error& e) {
+        std::cerr << e.what() << "\n" << description;
+        return 1;
+    }
+
+    if (format != "json" && format != "csv") {
+        std::cerr << "Unknown format " << format << std::endl;
+        return 1;
+    }
+
+    // DefaultAllocator is the baseline and always runs first
+    auto allocator_names = split(allocator_list);
+    allocator_names.erase(std::remove(allocator_names.begin(), allocator_names.end(), "default"),
+                          allocator_names.end());
+    allocator_names.insert(allocator_names.begin(), "default");
+    for (const auto& name : allocator_names) {
+        if (cls::tools::make_allocator(name) == nullptr) {
+            std::cerr << "Unknown allocator " << name << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<Result> results;
+    for (const auto& workload_name : split(workload_list)) {
+        auto workload = std::find_if(WORKLOADS.begin(), WORKLOADS.end(),
+                                     [&](const Workload& w) { return workload_name == w.name; });
+        if (workload == WORKLOADS.end()) {
+            std::cerr << "Unknown workload " << workload_name << std::endl;
+            return 1;
+        }
+
+        double baseline_ops_per_sec = 0;
+        for (const auto& allocator_name : allocator_names) {
+            // A fresh allocator for every run, so no run inherits another one's cached blocks
+            auto alloc = cls::tools::make_allocator(allocator_name);
+            auto measurement = workload->run(*alloc, options);
+
+            Result result;
+            result.workload = workload->name;
+            result.allocator = allocator_name;
+            result.num_threads = workload->multi_threaded ? (workload->run == handoff ? 2 : options.num_threads) : 1;
+            result.num_ops = measurement.num_ops;
+            result.ops_per_sec = measurement.seconds > 0 ? double(measurement.num_ops) / measurement.seconds : 0;
+            result.p50_ns = percentile(measurement.latencies, 0.5);
+            result.p99_ns = percentile(measurement.latencies, 0.99);
+            if (allocator_name == "default") {
+                baseline_ops_per_sec = result.ops_per_sec;
+            }
+            result.speedup = baseline_ops_per_sec > 0 ? result.ops_per_sec / baseline_ops_per_sec : 0;
+
+            results.push_back(result);
+        }
+    }
+
+    if (format == "csv") {
+        write_csv(std::cout, results);
+    } else {
+        write_json(std::cout, results);
+    }
+
+    return 0;
+}
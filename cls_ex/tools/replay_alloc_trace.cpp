@@ -0,0 +1,314 @@
+/////////////////////////////////////////////////////////////////////////////////
+// The MIT License(MIT)
+//
+// Copyright (c) 2016 Tiangang Song
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+/////////////////////////////////////////////////////////////////////////////////
+
+// Replay an allocation trace written by TracingAllocator against one of the allocators, and report throughput,
+// latency percentiles and peak RSS.
+//
+//   replay_alloc_trace trace.bin --allocator pool --threads
+//
+// Allocators are looked up in allocator_registry.h.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <boost/program_options.hpp>
+#include <cls_ex/allocator.h>
+#include "allocator_registry.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#  include <sys/resource.h>
+#endif
+
+namespace {
+// A trace event with its address replaced by the id of the block. Events on one block are numbered by seq so they
+// can be replayed in the recorded order from different threads.
+struct ReplayOp {
+    std::uint64_t size;
+    std::uint64_t old_size; // EXPAND only
+    std::uint32_t id;
+    std::uint32_t seq;
+    std::uint32_t thread;
+    std::uint8_t  op;
+    std::uint8_t  alignment_log2;
+};
+
+struct Replay {
+    std::vector<ReplayOp> ops;
+    std::vector<std::uint64_t> final_sizes;
+    std::uint32_t num_threads = 0;
+};
+
+Replay prepare(const std::vector<cls::AllocTraceRecord>& records)
+{
+    struct Block {
+        std::uint32_t id;
+        std::uint32_t seq;
+        std::uint64_t size;
+    };
+
+    Replay replay;
+    std::unordered_map<std::uint64_t, Block> live;
+
+    for (const auto& record : records) {
+        ReplayOp op {};
+        op.size = record.size;
+        op.thread = record.thread;
+        op.op = record.op;
+        op.alignment_log2 = record.alignment_log2;
+
+        if (record.op == cls::AllocTraceRecord::ALLOCATE) {
+            op.id = static_cast<std::uint32_t>(replay.final_sizes.size());
+            replay.final_sizes.push_back(record.size);
+            live[record.address] = Block {op.id, 1, record.size};
+        } else {
+            // Blocks allocated before the trace started are skipped
+            auto iter = live.find(record.address);
+            if (iter == live.end()) {
+                continue;
+            }
+
+            auto& block = iter->second;
+            op.id = block.id;
+            op.seq = block.seq++;
+            op.old_size = block.size;
+            block.size = record.size;
+            replay.final_sizes[block.id] = record.size;
+            if (record.op == cls::AllocTraceRecord::DEALLOCATE) {
+                replay.final_sizes[block.id] = 0;
+                live.erase(iter);
+            }
+        }
+
+        replay.ops.push_back(op);
+        replay.num_threads = std::max(replay.num_threads, record.thread + 1);
+    }
+
+    return replay;
+}
+
+// Blocks shared by the replay threads, ptrs[id] is only touched by the thread whose turn it is in seqs[id]
+class BlockTable {
+public:
+    explicit BlockTable(std::size_t num_blocks)
+        : m_ptrs(num_blocks, nullptr), m_seqs {new std::atomic<std::uint32_t>[num_blocks]()} {}
+
+    void wait_turn(const ReplayOp& op)
+    {
+        while (m_seqs[op.id].load(std::memory_order_acquire) != op.seq) {
+            std::this_thread::yield();
+        }
+    }
+
+    void end_turn(const ReplayOp& op) { m_seqs[op.id].store(op.seq + 1, std::memory_order_release); }
+
+    void*& ptr(std::uint32_t id) { return m_ptrs[id]; }
+
+private:
+    std::vector<void*> m_ptrs;
+    std::unique_ptr<std::atomic<std::uint32_t>[]> m_seqs;
+};
+
+void run_op(cls::Allocator& alloc, BlockTable& blocks, const ReplayOp& op)
+{
+    auto& p = blocks.ptr(op.id);
+    const auto size = static_cast<cls::size_type>(op.size);
+
+    switch (op.op) {
+    case cls::AllocTraceRecord::ALLOCATE:
+        p = op.alignment_log2 == 0 ? alloc.allocate(size)
+                                   : alloc.allocate(size, cls::size_type {1} << op.alignment_log2);
+        if (p == nullptr) {
+            std::cerr << "Allocation of " << size << " bytes failed" << std::endl;
+            std::exit(1);
+        }
+        break;
+    case cls::AllocTraceRecord::DEALLOCATE:
+        alloc.deallocate(p, size);
+        p = nullptr;
+        break;
+    case cls::AllocTraceRecord::EXPAND:
+        // Not every allocator can expand what another one could, move the block then
+        if (!alloc.try_expand(p, static_cast<cls::size_type>(op.old_size), size)) {
+            auto new_p = alloc.allocate(size);
+            if (new_p == nullptr) {
+                std::cerr << "Allocation of " << size << " bytes failed" << std::endl;
+                std::exit(1);
+            }
+            alloc.deallocate(p, static_cast<cls::size_type>(op.old_size));
+            p = new_p;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// Replay ops and return the latency of each in ns
+std::vector<std::int64_t> replay_ops(cls::Allocator& alloc, BlockTable& blocks, const std::vector<ReplayOp>& ops)
+{
+    std::vector<std::int64_t> latencies;
+    latencies.reserve(ops.size());
+
+    for (const auto& op : ops) {
+        blocks.wait_turn(op);
+        const auto start = std::chrono::steady_clock::now();
+        run_op(alloc, blocks, op);
+        const auto end = std::chrono::steady_clock::now();
+        blocks.end_turn(op);
+
+        latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    }
+
+    return latencies;
+}
+
+std::vector<std::vector<ReplayOp>> split_threads(const Replay& replay)
+{
+    std::vector<std::vector<ReplayOp>> thread_ops(replay.num_threads);
+    for (const auto& op : replay.ops) {
+        thread_ops[op.thread].push_back(op);
+    }
+
+    return thread_ops;
+}
+
+double peak_rss_mib()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+#  ifdef __APPLE__
+    return double(usage.ru_maxrss) / (1 << 20);
+#  else
+    return double(usage.ru_maxrss) / (1 << 10);
+#  endif
+#else
+    return 0;
+#endif
+}
+
+double percentile(std::vector<std::int64_t>& values, double p)
+{
+    if (values.empty()) {
+        return 0;
+    }
+
+    auto nth = values.begin() + static_cast<std::ptrdiff_t>(p * double(values.size() - 1));
+    std::nth_element(values.begin(), nth, values.end());
+    return double(*nth);
+}
+}
+
+int main(int argc, char* argv[])
+{
+    namespace po = boost::program_options;
+
+    std::string trace_path;
+    std::string allocator_name;
+
+    po::options_description options("Options");
+    options.add_options()
+        ("help,h", "Show this help")
+        ("trace", po::value(&trace_path)->required(), "Trace file written by TracingAllocator")
+        ("allocator,a", po::value(&allocator_name)->default_value("default"), cls::tools::allocator_names().c_str())
+        ("threads,t", "Replay each traced thread on its own thread, otherwise all events run in trace order on one");
+
+    po::positional_options_description positional;
+    positional.add("trace", 1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(options).positional(positional).run(), vm);
+        if (vm.count("help")) {
+            std::cout << "Usage: replay_alloc_trace <trace> [options]\n" << options;
+            return 0;
+        }
+        po::notify(vm);
+    } catch (const po::error& e) {
+        std::cerr << e.what() << "\n" << options;
+        return 1;
+    }
+
+    auto alloc = cls::tools::make_allocator(allocator_name);
+    if (alloc == nullptr) {
+        std::cerr << "Unknown allocator " << allocator_name << std::endl;
+        return 1;
+    }
+
+    std::vector<cls::AllocTraceRecord> records;
+    try {
+        records = cls::read_alloc_trace(trace_path);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    const auto replay = prepare(records);
+    BlockTable blocks {replay.final_sizes.size()};
+    std::vector<std::int64_t> latencies;
+    const auto rss_before = peak_rss_mib();
+
+    const auto start = std::chrono::steady_clock::now();
+    if (vm.count("threads")) {
+        const auto thread_ops = split_threads(replay);
+        std::vector<std::vector<std::int64_t>> thread_latencies(thread_ops.size());
+        std::vector<std::thread> threads;
+        for (std::size_t i = 0; i < thread_ops.size(); ++i) {
+            threads.emplace_back([&, i] { thread_latencies[i] = replay_ops(*alloc, blocks, thread_ops[i]); });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        for (const auto& thread_latency : thread_latencies) {
+            latencies.insert(latencies.end(), thread_latency.begin(), thread_latency.end());
+        }
+    } else {
+        latencies = replay_ops(*alloc, blocks, replay.ops);
+    }
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Blocks still live at the end of the trace
+    for (std::size_t id = 0; id < replay.final_sizes.size(); ++id) {
+        if (blocks.ptr(static_cast<std::uint32_t>(id)) != nullptr) {
+            alloc->deallocate(blocks.ptr(static_cast<std::uint32_t>(id)),
+                              static_cast<cls::size_type>(replay.final_sizes[id]));
+        }
+    }
+
+    std::printf("allocator:   %s\n", allocator_name.c_str());
+    std::printf("events:      %zu on %u threads\n", replay.ops.size(), replay.num_threads);
+    std::printf("elapsed:     %.3f ms\n", elapsed * 1e3);
+    std::printf("throughput:  %.0f events/s\n", elapsed > 0 ? double(replay.ops.size()) / elapsed : 0.0);
+    std::printf("latency ns:  p50 %.0f, p90 %.0f, p99 %.0f, p99.9 %.0f, max %.0f\n", percentile(latencies, 0.5),
+                percentile(latencies, 0.9), percentile(latencies, 0.99), percentile(latencies, 0.999),
+                percentile(latencies, 1.0));
+    std::printf("peak RSS:    %.1f MiB (%.1f MiB before replay)\n", peak_rss_mib(), rss_before);
+
+    return 0;
+}